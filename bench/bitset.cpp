@@ -0,0 +1,75 @@
+// hierarchical_bitset against the flat bitvector at 1%, 50% and 99% occupancy, over 2^20 bits.
+// first_unset: finding a free slot when the set bits are packed at the front, as allocating lowest-first leaves them.
+// first_set: finding the first element when the set bits are all at the back, as after freeing the front.
+// iterate: walking every set bit when they're scattered at random.
+#include <common/bit.h>
+#include <common/stopwatch.h>
+#include <cstdio>
+#include <random>
+
+constexpr size_t num_bits = 1 << 20;
+constexpr size_t lookups = 2000;
+
+template <typename B>
+static B make(size_t first, size_t last) {
+    B b(num_bits);
+    for (size_t i = first; i < last; i++)
+        b.set(i);
+    return b;
+}
+
+template <typename B>
+static B make_scattered(double occupancy) {
+    std::mt19937 rng(11);
+    std::bernoulli_distribution taken(occupancy);
+    B b(num_bits);
+    for (size_t i = 0; i < num_bits; i++) {
+        if (taken(rng))
+            b.set(i);
+    }
+    return b;
+}
+
+template <typename B>
+static void run(const char* name, double occupancy) {
+    size_t n = size_t(num_bits * occupancy);
+    stopwatch timer;
+    size_t checksum = 0;
+
+    // each lookup claims the slot and frees it again, so the compiler can't hoist the search out of the loop
+    B packed = make<B>(0, n);
+    timer.start();
+    for (size_t i = 0; i < lookups; i++) {
+        size_t free_slot = packed.least_unset_bit();
+        packed.set(free_slot);
+        packed.clear(free_slot);
+        checksum += free_slot;
+    }
+    double unset_ns = timer.elapsed<std::chrono::nanoseconds>() / double(lookups);
+
+    B tail = make<B>(num_bits - n, num_bits);
+    timer.start();
+    for (size_t i = 0; i < lookups; i++) {
+        size_t first = tail.least_set_bit();
+        tail.clear(first);
+        tail.set(first);
+        checksum += first;
+    }
+    double set_ns = timer.elapsed<std::chrono::nanoseconds>() / double(lookups);
+
+    B scattered = make_scattered<B>(occupancy);
+    timer.start();
+    for (size_t i : scattered)
+        checksum += i;
+    size_t iterate_us = timer.elapsed<stopwatch::microseconds>();
+
+    std::printf("%-20s %6.0f%% %14.0f %12.0f %12zu   (%zu)\n", name, occupancy * 100, unset_ns, set_ns, iterate_us, checksum);
+}
+
+int main() {
+    std::printf("%-20s %7s %14s %12s %12s\n", "structure", "full", "first_unset_ns", "first_set_ns", "iterate_us");
+    for (double occupancy : {0.01, 0.5, 0.99}) {
+        run<bitvector>("bitvector", occupancy);
+        run<hierarchical_bitset>("hierarchical_bitset", occupancy);
+    }
+}
@@ -0,0 +1,65 @@
+// Candidate pairs and collision pass times for each broad phase at 1k, 10k and 100k boxes, spread at a constant
+// density. The first pass builds everything from scratch; after it, a tenth of the boxes move a few pixels per tick.
+#include <engine/contacts.h>
+#include <common/thread_pool.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+using namespace ecs;
+
+constexpr size_t ticks = 20;
+constexpr float area_per_box = 40 * 40;
+
+static collision::hitbox make_box(int x, int y, int w, int h) {
+    return {vec2<uint16_t>{uint16_t(x), uint16_t(y)}, {uint16_t(x + w), uint16_t(y)}, {uint16_t(x), uint16_t(y + h)},
+            {uint16_t(x + w), uint16_t(y + h)}};
+}
+
+static void run(const char* name, broadphase_mode mode, size_t n, thread_pool& workers) {
+    std::mt19937 rng(7);
+    int side = int(std::sqrt(n * area_per_box));
+    std::uniform_int_distribution<int> pos(4, side - 4), size(8, 24), step(-2, 2);
+
+    entity_manager em;
+    collision_world world;
+    world.mode = mode;
+    std::vector<entity> entities;
+    for (size_t i = 0; i < n; i++) {
+        entity e = em.add_entity();
+        em.add<collision>(e).hitboxes.emplace_back(make_box(pos(rng), pos(rng), size(rng), size(rng)));
+        entities.emplace_back(e);
+    }
+
+    run_collision(em, world, workers);
+    size_t build_us = world.stats.elapsed_us;
+
+    size_t total_us = 0, total_pairs = 0, total_overlaps = 0;
+    for (size_t t = 0; t < ticks; t++) {
+        for (size_t i = 0; i < n / 10; i++) {
+            collision::hitbox& hb = em.get<collision>(entities[rng() % n]).hitboxes[0];
+            aabb<uint16_t> b = hitbox_bounds(hb);
+            int x = std::clamp(b.min.x + step(rng), 0, side), y = std::clamp(b.min.y + step(rng), 0, side);
+            hb = make_box(x, y, b.max.x - b.min.x, b.max.y - b.min.y);
+        }
+        run_collision(em, world, workers);
+        total_us += world.stats.elapsed_us;
+        total_pairs += world.stats.candidate_pairs;
+        total_overlaps += world.stats.overlaps;
+    }
+    std::printf("%-12s %8zu %14zu %10zu %10zu %10zu\n", name, n, total_pairs / ticks, total_overlaps / ticks, build_us,
+                total_us / ticks);
+}
+
+int main() {
+    thread_pool workers;
+    std::printf("%-12s %8s %14s %10s %10s %10s\n", "mode", "boxes", "pairs", "overlaps", "build_us", "tick_us");
+    for (size_t n : {1000, 10000, 100000}) {
+        // every pair of 10k boxes is 50M candidates, too many to hold
+        if (n <= 1000)
+            run("bruteforce", broadphase_mode::brute_force, n, workers);
+        run("grid", broadphase_mode::grid, n, workers);
+        run("sap", broadphase_mode::sweep_and_prune, n, workers);
+    }
+}
@@ -0,0 +1,57 @@
+// Throughput of concurrent_marked_vector with 1 to 16 threads adding and removing at once, as loaders adding sprites
+// do. Each thread inserts a batch, removes half of it and repeats, so the table both grows and refills freed slots.
+// Speedup is relative to a single thread, so on a machine with a single core it shows the cost of contention instead.
+#include <common/marked_array.h>
+#include <common/stopwatch.h>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+struct item {
+    std::vector<float> verts = std::vector<float>(16);
+    unsigned tex_id = 0;
+};
+
+constexpr size_t total_ops = 1 << 20;
+constexpr size_t batch = 512;
+
+static void run(size_t num_threads, size_t& single_us) {
+    concurrent_marked_vector<item> v;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> checksum = 0;
+    stopwatch timer;
+    timer.start();
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&] {
+            item e;
+            std::vector<size_t> ids;
+            size_t sum = 0;
+            for (size_t done = 0; done < total_ops / num_threads; done += batch) {
+                for (size_t i = 0; i < batch; i++)
+                    ids.push_back(v.insert_any(e));
+                for (size_t i = ids.size() / 2; i < ids.size(); i++) {
+                    sum += ids[i];
+                    v.remove(ids[i]);
+                }
+                ids.resize(ids.size() / 2);
+            }
+            checksum += sum;
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    size_t us = timer.elapsed<stopwatch::microseconds>();
+    if (num_threads == 1)
+        single_us = us;
+    std::printf("%8zu %12zu %14.1f %8.2f %10zu   (%zu)\n", num_threads, us, us * 1000.0 / total_ops,
+                double(single_us) / us, v.size(), checksum.load());
+}
+
+int main() {
+    std::printf("%zu hardware threads\n", size_t(std::thread::hardware_concurrency()));
+    std::printf("%8s %12s %14s %8s %10s\n", "threads", "time_us", "ns_per_insert", "speedup", "live");
+    size_t single_us = 0;
+    for (size_t threads : {1, 2, 4, 8, 16})
+        run(threads, single_us);
+}
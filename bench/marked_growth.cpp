@@ -0,0 +1,63 @@
+// Insert throughput while the container is growing, starting empty each time, at 1k and 100k elements.
+// marked_vector doubles and moves every element when it runs out of room, while concurrent_marked_vector (the
+// sprite table) adds a page and never moves anything. The element owns a heap vector like the renderer's spritedata,
+// so a move is more than a memcpy. worst_us is the slowest single insert, which is where the growth cost shows up.
+// The same goes for the ECS pools: a sparse_set keeps its elements in pages, against a plain std::vector underneath.
+#include <common/marked_array.h>
+#include <common/sparse_set.h>
+#include <common/stopwatch.h>
+#include <cstdio>
+#include <vector>
+
+struct item {
+    std::vector<float> verts = std::vector<float>(16);
+    unsigned tex_id = 0;
+};
+
+constexpr int rounds = 5;
+
+struct std_vector_pool {
+    std::vector<item> v;
+    size_t insert_any(const item& e) {
+        v.emplace_back(e);
+        return v.size() - 1;
+    }
+};
+struct sparse_set_pool {
+    sparse_set<item> s;
+    size_t insert_any(const item& e) {
+        s.insert(s.size(), e);
+        return s.size() - 1;
+    }
+};
+
+template <typename V>
+static void run(const char* name, size_t n) {
+    stopwatch total, one;
+    size_t total_ns = 0, worst_ns = 0, checksum = 0;
+    for (int r = 0; r < rounds; r++) {
+        V v;
+        item e;
+        total.start();
+        for (size_t i = 0; i < n; i++) {
+            e.tex_id = unsigned(i);
+            one.start();
+            checksum += v.insert_any(e);
+            size_t ns = one.elapsed<std::chrono::nanoseconds>();
+            if (ns > worst_ns)
+                worst_ns = ns;
+        }
+        total_ns += total.elapsed<std::chrono::nanoseconds>();
+    }
+    std::printf("%-26s %8zu %12.1f %10.1f   (%zu)\n", name, n, total_ns / double(rounds * n), worst_ns / 1000.0, checksum);
+}
+
+int main() {
+    std::printf("%-26s %8s %12s %10s\n", "container", "inserts", "ns_per_insert", "worst_us");
+    for (size_t n : {size_t(1000), size_t(100000)}) {
+        run<marked_vector<item>>("marked_vector", n);
+        run<concurrent_marked_vector<item>>("concurrent_marked_vector", n);
+        run<std_vector_pool>("std::vector", n);
+        run<sparse_set_pool>("sparse_set", n);
+    }
+}
@@ -0,0 +1,82 @@
+// Save and restore cost of a 10k entity world into a snapshot ring, the way savestate and loadstate do it.
+// Renderer sprite data needs a GL context, so it's left out here; everything else savestate writes is included.
+#include <engine/aabb_tree.h>
+#include <engine/contacts.h>
+#include <engine/snapshot.h>
+#include <common/stopwatch.h>
+#include <common/thread_pool.h>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+using namespace ecs;
+
+constexpr size_t num_entities = 10000;
+constexpr size_t repeats = 200;
+
+int main() {
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> pos(0, 4000), size(8, 24);
+
+    entity_manager em;
+    aabb_tree spatial;
+    collision_world world;
+    thread_pool workers;
+    for (size_t i = 0; i < num_entities; i++) {
+        entity e = em.add_entity();
+        display& d = em.add<display>(e);
+        d.sprites.emplace_back(uint32_t(2 * i));
+        d.sprites.emplace_back(uint32_t(2 * i + 1));
+
+        uint16_t x = pos(rng), y = pos(rng), w = size(rng), h = size(rng);
+        collision& c = em.add<collision>(e);
+        c.hitboxes.emplace_back(collision::hitbox{vec2<uint16_t>{x, y}, {uint16_t(x + w), y}, {x, uint16_t(y + h)},
+                                                  {uint16_t(x + w), uint16_t(y + h)}});
+        c.proxies.emplace_back(spatial.insert(hitbox_bounds(c.hitboxes[0]).to<int32_t>(), hitbox_ref{e, 0}));
+        em.add<physics>(e);
+    }
+    run_collision(em, world, workers);
+
+    // frames are preallocated for a snapshot of this world, as a game would after checking snapshotstats
+    std::vector<uint8_t> sizing;
+    snapshot_writer measure(sizing);
+    em.save(measure);
+    spatial.save(measure);
+    world.cache.save(measure);
+    snapshot_ring ring(64, sizing.size());
+    std::vector<uint64_t> frames;
+    std::vector<size_t> save_us, load_us;
+    size_t bytes = 0;
+    stopwatch timer;
+    for (size_t i = 0; i < repeats; i++) {
+        timer.start();
+        uint64_t frame;
+        std::vector<uint8_t>& buf = ring.next(frame);
+        snapshot_writer w(buf);
+        em.save(w);
+        spatial.save(w);
+        world.cache.save(w);
+        save_us.emplace_back(timer.elapsed<stopwatch::microseconds>());
+        bytes = buf.size();
+        frames.emplace_back(frame);
+    }
+    for (size_t i = 0; i < repeats; i++) {
+        // restore the frames still in the ring, newest first, like rolling back further and further
+        const std::vector<uint8_t>* buf = ring.find(frames[repeats - 1 - i % ring.size()]);
+        timer.start();
+        snapshot_reader r(*buf);
+        em.load(r);
+        spatial.load(r);
+        world.cache.load(r);
+        load_us.emplace_back(timer.elapsed<stopwatch::microseconds>());
+    }
+
+    // the median is the steady state, and the max the worst case
+    auto report = [](const char* name, std::vector<size_t>& us) {
+        std::sort(us.begin(), us.end());
+        std::printf("%-6s median %6zu us, max %6zu us\n", name, us[us.size() / 2], us.back());
+    };
+    std::printf("%zu entities, %zu bytes per frame, %zu frame ring\n", num_entities, bytes, ring.size());
+    report("save", save_us);
+    report("load", load_us);
+}
@@ -0,0 +1,93 @@
+// Times the two parallel loops of a tick, integration and the narrow phase, on thread pools of 1 to 16 workers.
+// Speedup is relative to the single worker pool, so it stays flat on a machine with a single core.
+#include <engine/broadphase.h>
+#include <engine/narrowphase.h>
+#include <engine/physics.h>
+#include <common/stopwatch.h>
+#include <common/thread_pool.h>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+using namespace ecs;
+
+constexpr size_t num_bodies = 1 << 20;
+constexpr size_t num_boxes = 100000;
+constexpr size_t repeats = 20;
+
+// same chunk size as run_physics
+constexpr size_t bodies_per_chunk = 1024;
+
+static body_columns make_bodies(std::mt19937& rng) {
+    std::uniform_real_distribution<float> pos(0, 60000), accel(-0.1f, 0.1f);
+    body_columns b;
+    b.for_each_column([](auto& c) { c.resize(num_bodies); });
+    for (size_t i = 0; i < num_bodies; i++) {
+        b.x[i] = pos(rng);
+        b.y[i] = pos(rng);
+        b.accel_x[i] = accel(rng);
+        b.accel_y[i] = accel(rng);
+        b.cap_x[i] = b.cap_y[i] = 8;
+    }
+    return b;
+}
+
+// boxes of 8 to 40 pixels, overlapping three or four others each
+static std::vector<collision::hitbox> make_hitboxes(std::mt19937& rng) {
+    uint16_t side = 8192;
+    std::uniform_int_distribution<int> pos(0, side - 41), size(8, 40);
+    std::vector<collision::hitbox> out(num_boxes);
+    for (auto& hb : out) {
+        uint16_t x = pos(rng), y = pos(rng), w = size(rng), h = size(rng);
+        hb = {vec2<uint16_t>{x, y}, {uint16_t(x + w), y}, {x, uint16_t(y + h)}, {uint16_t(x + w), uint16_t(y + h)}};
+    }
+    return out;
+}
+
+int main() {
+    std::mt19937 rng(1234);
+    body_columns bodies = make_bodies(rng);
+    std::vector<collision::hitbox> hitboxes = make_hitboxes(rng);
+    hitbox_store boxes;
+    std::vector<uint32_t> all;
+    for (uint32_t i = 0; i < hitboxes.size(); i++)
+        all.emplace_back(boxes.add(hitboxes[i], hitbox_ref{i, 0}));
+    std::vector<uint8_t> touched(all.size(), 1);
+    std::vector<candidate_pair> pairs, contacts;
+    uniform_grid grid(64);
+    grid.update(boxes, all, {}, touched, pairs);
+    std::sort(pairs.begin(), pairs.end());
+
+    std::printf("%zu bodies, %zu boxes, %zu candidate pairs, %u hardware threads\n", num_bodies, num_boxes, pairs.size(),
+                std::thread::hardware_concurrency());
+    std::printf("%8s %16s %8s %16s %8s\n", "threads", "integrate_us", "speedup", "narrowphase_us", "speedup");
+    double base_integrate = 0, base_narrow = 0;
+    for (size_t threads : {1, 2, 4, 8, 16}) {
+        thread_pool workers(threads);
+        stopwatch timer;
+
+        timer.start();
+        for (size_t r = 0; r < repeats; r++) {
+            workers.parallel_for<uint16_t>(0, num_bodies, bodies_per_chunk, [&](size_t lo, size_t hi) {
+                integrate_bodies(bodies, lo, hi);
+                update_rest(bodies, lo, hi);
+            });
+        }
+        double integrate = double(timer.elapsed<stopwatch::microseconds>()) / repeats;
+
+        timer.start();
+        for (size_t r = 0; r < repeats; r++) {
+            contacts.clear();
+            narrow_phase(boxes, pairs, contacts, workers);
+        }
+        double narrow = double(timer.elapsed<stopwatch::microseconds>()) / repeats;
+
+        if (threads == 1) {
+            base_integrate = integrate;
+            base_narrow = narrow;
+        }
+        std::printf("%8zu %16.0f %8.2f %16.0f %8.2f\n", threads, integrate, base_integrate / integrate, narrow,
+                    base_narrow / narrow);
+    }
+    std::printf("%zu contacts\n", contacts.size());
+}
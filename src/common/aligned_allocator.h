@@ -0,0 +1,24 @@
+#ifndef ALIGNED_ALLOCATOR_H
+#define ALIGNED_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+constexpr size_t cache_line_size = 64;
+
+// An allocator whose memory starts on a cache line, so an array split between threads at whole cache lines of its
+// elements never has two threads writing to the same line
+template <typename T>
+struct cache_aligned_allocator {
+    using value_type = T;
+
+    cache_aligned_allocator() = default;
+    template <typename U> cache_aligned_allocator(const cache_aligned_allocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(cache_line_size))); }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(cache_line_size)); }
+
+    template <typename U> bool operator==(const cache_aligned_allocator<U>&) const { return true; }
+};
+
+#endif //ALIGNED_ALLOCATOR_H
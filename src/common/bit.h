@@ -26,26 +26,33 @@ public:
 
     size_t least_set_bit() const { return bitscan<std::countr_zero, until_first>(0); }
     size_t least_unset_bit() const { return bitscan<std::countr_one, until_first>(0); }
-    size_t next_set_bit(size_t index) {
-        element_type elem_backup = data[_element(index)];
-        element_type clear_mask = (_mask(index) << 1) - 1;
-        data[_element(index)] &= ~clear_mask;
-        size_t scan = bitscan<std::countr_zero, until_first>(_element(index));
-        data[_element(index)] = elem_backup;
-        return std::min(size_t(capacity()), scan + (_element(index) *  bits_per_element));
-    }
-
-    size_t popcnt_before(size_t index) {
-        if (index == 0)
-            return 0;
-        size_t size = 0;
-        for (size_t i = 0; i < index / bits_per_element; i++) {
-            size += std::popcount(data[i]);
+    // the first set bit after `index`, or capacity() if there isn't one
+    size_t next_set_bit(size_t index) const {
+        size_t w = _element(index);
+        if (w >= data.size())
+            return capacity();
+        element_type clear_mask = element_type(_mask(index) << 1) - 1;
+        element_type bits = data[w] & ~clear_mask;
+        for (; bits == 0; bits = data[w]) {
+            if (++w == data.size())
+                return capacity();
         }
+        return w * bits_per_element + std::countr_zero(bits);
+    }
 
-        size_t bruh = bits_per_element;
-        auto bmask = (1 << (index % bits_per_element) + 1) - 1;
-        return size + std::popcount(data[_element(index)] & bmask);
+    // Raw access to the underlying words, for combining several bitarrays a word at a time.
+    // Words past the end read as zero.
+    element_type word(size_t i) const { return i < data.size() ? data[i] : 0; }
+    size_t num_words() const { return data.size(); }
+
+    // the number of set bits below `index`; see ranked_bitvector for doing this without walking every word
+    size_t popcnt_before(size_t index) const {
+        size_t size = 0;
+        for (size_t i = 0; i < _element(index); i++)
+            size += std::popcount(data[i]);
+        if (_element(index) < data.size())
+            size += std::popcount(element_type(data[_element(index)] & element_type(_mask(index) - 1)));
+        return size;
     }
 
     class iterator {
@@ -59,18 +66,18 @@ public:
         }
         bool pte() { return idx >= ctr->capacity(); }
     private:
-        iterator(size_t idx, bitarray_base<storage_t>* ctr) : idx(idx), ctr(ctr) {
+        iterator(size_t idx, const bitarray_base<storage_t>* ctr) : idx(idx), ctr(ctr) {
             if (idx != ctr->capacity() && ctr->get(idx) == false)
                 ++(*this);
         };
 
         size_t idx = 0;
-        bitarray_base<storage_t>* ctr = nullptr;
+        const bitarray_base<storage_t>* ctr = nullptr;
         friend class bitarray_base<storage_t>;
     };
 
-    iterator begin() { return iterator(0, this); }
-    iterator end() { return iterator(capacity(), this); }
+    iterator begin() const { return iterator(0, this); }
+    iterator end() const { return iterator(capacity(), this); }
 private:
     typedef int (*scan_function)(element_type);
     typedef bool (*predicate_function)(element_type);
@@ -115,4 +122,291 @@ public:
     void resize(size_t num_bits) { this->data.resize(elems_for(num_bits)); }
 };
 
+// A bitvector that also answers rank (how many bits are set below an index) and select (where the k-th set bit is).
+// Set bits are counted cumulatively per block of 8 words, and the block holding every 512th set bit is sampled, so
+// both are a table lookup plus a scan of at most one block. Setting or clearing a bit updates the counts of every
+// block above it, which makes changes O(capacity / 512) and lookups O(1).
+class ranked_bitvector : public bitarray_base<std::vector<size_t>> {
+public:
+    constexpr static size_t words_per_block = 8;
+    constexpr static size_t bits_per_block = words_per_block * bits_per_element;
+    constexpr static size_t select_sample_rate = 512;
+
+    ranked_bitvector() = default;
+    ranked_bitvector(size_t num_bits) { resize(num_bits); }
+    void resize(size_t num_bits) {
+        this->data.resize(elems_for(num_bits));
+        rebuild();
+    }
+
+    void set(size_t index) {
+        if (!get(index)) {
+            bitarray_base::set(index);
+            adjust(index, 1);
+        }
+    }
+    void clear(size_t index) {
+        if (get(index)) {
+            bitarray_base::clear(index);
+            adjust(index, -1);
+        }
+    }
+    void write(size_t index, int val) { val ? set(index) : clear(index); }
+    size_t size() const { return block_rank.back(); }
+
+    // the number of set bits below `index`
+    size_t rank(size_t index) const {
+        size_t w = index / bits_per_element;
+        if (w >= this->data.size())
+            return size();
+        size_t r = block_rank[w / words_per_block];
+        for (size_t i = w - w % words_per_block; i < w; i++)
+            r += std::popcount(this->data[i]);
+        return r + std::popcount(this->data[w] & ((element_type(1) << (index % bits_per_element)) - 1));
+    }
+    // the index of the set bit with rank `k`, counting from 0, or capacity() if fewer than k + 1 bits are set
+    size_t select(size_t k) const {
+        if (k >= size())
+            return capacity();
+        size_t b = select_samples[k / select_sample_rate];
+        while (block_rank[b + 1] <= k)
+            b++;
+        k -= block_rank[b];
+        for (size_t w = b * words_per_block;; w++) {
+            element_type word = this->data[w];
+            size_t count = std::popcount(word);
+            if (k < count) {
+                for (; k > 0; k--)
+                    word &= word - 1;
+                return w * bits_per_element + std::countr_zero(word);
+            }
+            k -= count;
+        }
+    }
+private:
+    void adjust(size_t index, int delta) {
+        for (size_t b = index / bits_per_block + 1; b < block_rank.size(); b++)
+            block_rank[b] += delta;
+        sample();
+    }
+    void rebuild() {
+        size_t blocks = (this->data.size() + words_per_block - 1) / words_per_block;
+        block_rank.assign(blocks + 1, 0);
+        for (size_t w = 0; w < this->data.size(); w++)
+            block_rank[w / words_per_block + 1] += std::popcount(this->data[w]);
+        for (size_t b = 1; b <= blocks; b++)
+            block_rank[b] += block_rank[b - 1];
+        sample();
+    }
+    void sample() {
+        select_samples.clear();
+        for (size_t b = 0; b + 1 < block_rank.size(); b++) {
+            while (select_samples.size() * select_sample_rate < block_rank[b + 1])
+                select_samples.emplace_back(b);
+        }
+    }
+
+    std::vector<uint32_t> block_rank{0};  // set bits below each block, then the total
+    std::vector<uint32_t> select_samples; // the block holding each select_sample_rate'th set bit
+};
+
+// A bitvector with summary levels stacked above it. Bit i of a summary word says whether word i of the level below
+// has any bit set (the `nonempty` stack) or any bit clear (the `nonfull` stack), and levels are added until the top
+// fits in one word. Finding the first set or unset bit, or the next set bit after one, climbs to the first summary
+// word with a candidate and walks straight back down, so it touches a word or two per level however many bits are
+// tracked, instead of scanning every word in between.
+class hierarchical_bitset {
+public:
+    using element_type = size_t;
+    constexpr static size_t bits_per_element = std::numeric_limits<element_type>::digits;
+
+    hierarchical_bitset() = default;
+    hierarchical_bitset(size_t num_bits) { resize(num_bits); }
+
+    bool get(size_t index) const { return data[index / bits_per_element] & mask(index); }
+    void set(size_t index) {
+        size_t w = index / bits_per_element;
+        element_type old = data[w];
+        data[w] |= mask(index);
+        if (old == data[w])
+            return;
+        count++;
+        if (old == 0)
+            mark(nonempty, w);
+        if (data[w] == ~element_type(0))
+            unmark(nonfull, w);
+    }
+    void clear(size_t index) {
+        size_t w = index / bits_per_element;
+        element_type old = data[w];
+        data[w] &= ~mask(index);
+        if (old == data[w])
+            return;
+        count--;
+        if (data[w] == 0)
+            unmark(nonempty, w);
+        if (old == ~element_type(0))
+            mark(nonfull, w);
+    }
+    void write(size_t index, int val) { val ? set(index) : clear(index); }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return data.size() * bits_per_element; }
+    // Growing or shrinking rebuilds the summaries, so it costs a pass over every word
+    void resize(size_t num_bits) {
+        data.resize(elems_for(num_bits));
+        rebuild();
+    }
+
+    size_t least_set_bit() const { return next_set_bit_from(0); }
+    size_t least_unset_bit() const {
+        size_t w = find(nonfull, 0);
+        return w == npos ? capacity() : w * bits_per_element + std::countr_one(data[w]);
+    }
+    // the first set bit after `index`, or capacity() if there isn't one
+    size_t next_set_bit(size_t index) const {
+        size_t w = index / bits_per_element;
+        if (w >= data.size())
+            return capacity();
+        element_type clear_mask = element_type(mask(index) << 1) - 1;
+        element_type bits = data[w] & ~clear_mask;
+        if (bits)
+            return w * bits_per_element + std::countr_zero(bits);
+        return next_set_bit_from((w + 1) * bits_per_element);
+    }
+
+    // Raw access to the underlying words, as with bitvector. Words past the end read as zero.
+    element_type word(size_t i) const { return i < data.size() ? data[i] : 0; }
+    size_t num_words() const { return data.size(); }
+    // the first word at or after `w` with any bit set, or num_words() if there isn't one
+    size_t next_nonzero_word(size_t w) const {
+        size_t found = find(nonempty, w);
+        return found == npos ? num_words() : found;
+    }
+
+    class iterator {
+    public:
+        bool operator!=(const iterator& rhs) const { return idx != rhs.idx; }
+        bool operator==(const iterator& rhs) const { return !(*this != rhs); }
+        size_t operator*() const { return idx; }
+        iterator operator++() {
+            idx = ctr->next_set_bit(idx);
+            return *this;
+        }
+    private:
+        iterator(size_t idx, const hierarchical_bitset* ctr) : idx(idx), ctr(ctr) {}
+
+        size_t idx = 0;
+        const hierarchical_bitset* ctr = nullptr;
+        friend class hierarchical_bitset;
+    };
+
+    iterator begin() const { return iterator(least_set_bit(), this); }
+    iterator end() const { return iterator(capacity(), this); }
+
+    // Writes every level as-is, so loading doesn't need to rebuild anything. `W` and `R` are a snapshot_writer and
+    // snapshot_reader, or anything else with array() and value().
+    template <typename W> void save(W& w) const {
+        w.array(data);
+        w.value(uint64_t(nonempty.size()));
+        for (size_t k = 0; k < nonempty.size(); k++) {
+            w.array(nonempty[k]);
+            w.array(nonfull[k]);
+        }
+        w.value(uint64_t(count));
+    }
+    template <typename R> void load(R& r) {
+        r.array(data);
+        uint64_t levels = r.template value<uint64_t>();
+        nonempty.resize(levels);
+        nonfull.resize(levels);
+        for (size_t k = 0; k < levels; k++) {
+            r.array(nonempty[k]);
+            r.array(nonfull[k]);
+        }
+        count = r.template value<uint64_t>();
+    }
+private:
+    using summary = std::vector<std::vector<element_type>>;
+    constexpr static size_t npos = SIZE_MAX;
+
+    static element_type mask(size_t index) { return element_type(1) << (index % bits_per_element); }
+
+    size_t next_set_bit_from(size_t index) const {
+        size_t w = index / bits_per_element;
+        if (w < data.size() && (data[w] & ~(mask(index) - 1)))
+            return w * bits_per_element + std::countr_zero(data[w] & ~(mask(index) - 1));
+        w = find(nonempty, w + (index % bits_per_element != 0));
+        return w == npos ? capacity() : w * bits_per_element + std::countr_zero(data[w]);
+    }
+
+    // Sets word `w`'s bit in the lowest level, and carries on up for as long as that turns a zero word nonzero
+    static void mark(summary& levels, size_t w) {
+        for (auto& level : levels) {
+            element_type& word = level[w / bits_per_element];
+            bool was_zero = word == 0;
+            word |= mask(w);
+            if (!was_zero)
+                return;
+            w /= bits_per_element;
+        }
+    }
+    // Clears word `w`'s bit in the lowest level, and carries on up for as long as that leaves a word zero
+    static void unmark(summary& levels, size_t w) {
+        for (auto& level : levels) {
+            element_type& word = level[w / bits_per_element];
+            word &= ~mask(w);
+            if (word != 0)
+                return;
+            w /= bits_per_element;
+        }
+    }
+    // The first data word at or after `w` whose bit is set in `levels`, or npos. Climbs until a level has a set bit
+    // at or after the position, then follows the lowest set bit of each word back down.
+    static size_t find(const summary& levels, size_t w) {
+        size_t k = 0;
+        for (; k < levels.size(); k++) {
+            size_t i = w / bits_per_element;
+            if (i >= levels[k].size())
+                return npos;
+            element_type bits = levels[k][i] & ~(mask(w) - 1);
+            if (bits) {
+                w = i * bits_per_element + std::countr_zero(bits);
+                break;
+            }
+            w = i + 1;
+        }
+        if (k == levels.size())
+            return npos;
+        while (k-- > 0)
+            w = w * bits_per_element + std::countr_zero(levels[k][w]);
+        return w;
+    }
+
+    void rebuild() {
+        nonempty.clear();
+        nonfull.clear();
+        count = 0;
+        for (element_type word : data)
+            count += std::popcount(word);
+        if (data.empty())
+            return;
+        for (size_t n = data.size(); nonempty.empty() || n > 1; n = elems_for(n)) {
+            nonempty.emplace_back(elems_for(n), 0);
+            nonfull.emplace_back(elems_for(n), 0);
+        }
+        for (size_t w = 0; w < data.size(); w++) {
+            if (data[w] != 0)
+                mark(nonempty, w);
+            if (data[w] != ~element_type(0))
+                mark(nonfull, w);
+        }
+    }
+
+    std::vector<element_type> data;
+    summary nonempty;
+    summary nonfull;
+    size_t count = 0;
+};
+
 #endif //BIT_H
@@ -0,0 +1,121 @@
+#ifndef FLAT_HASH_MAP_H
+#define FLAT_HASH_MAP_H
+
+#include <common/snapshot_stream.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A hash map kept in a single array of slots, probed linearly, for trivially copyable keys and values. With nothing
+// behind pointers, the whole map is saved and restored as one block. Erased slots are left as tombstones, so entries
+// can be erased while walking the map, until the next insert that fills it up enough to rehash.
+template <typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K>>
+class flat_hash_map {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>, "Slots are copied as raw memory");
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear() {
+        slots.assign(slots.size(), slot{});
+        count = used = 0;
+    }
+    void reserve(size_t n) {
+        if (n * 2 > slots.size())
+            rehash(std::max<size_t>(16, std::bit_ceil(n * 2)));
+    }
+
+    V* find(const K& k) {
+        if (slots.empty())
+            return nullptr;
+        for (size_t i = home(k);; i = (i + 1) & mask()) {
+            slot& s = slots[i];
+            if (s.state == empty_slot)
+                return nullptr;
+            if (s.state == full_slot && Equal()(s.key, k))
+                return &s.value;
+        }
+    }
+    // Inserts `v` under `k` unless it's already there, and returns the value under `k` and whether it was inserted
+    std::pair<V*, bool> try_emplace(const K& k, const V& v) {
+        if (V* found = find(k))
+            return {found, false};
+        // at most three quarters full, tombstones included, so probes stay short and always end
+        if ((used + 1) * 4 > slots.size() * 3)
+            rehash(std::max<size_t>(16, std::bit_ceil((count + 1) * 2)));
+        size_t i = home(k);
+        while (slots[i].state == full_slot)
+            i = (i + 1) & mask();
+        if (slots[i].state == empty_slot)
+            used++;
+        slots[i] = slot{k, v, full_slot};
+        count++;
+        return {&slots[i].value, true};
+    }
+
+    // calls f(key, value) for every entry, in no particular order
+    template <typename F> void for_each(F&& f) const {
+        for (const slot& s : slots) {
+            if (s.state == full_slot)
+                f(s.key, s.value);
+        }
+    }
+    // calls f(key, value) for every entry, and erases the ones it returns true for
+    template <typename F> void erase_if(F&& f) {
+        for (slot& s : slots) {
+            if (s.state == full_slot && f(s.key, s.value)) {
+                s.state = erased_slot;
+                count--;
+            }
+        }
+    }
+
+    void save(snapshot_writer& w) const {
+        w.value<uint64_t>(count);
+        w.value<uint64_t>(used);
+        w.array(slots);
+    }
+    void load(snapshot_reader& r) {
+        count = r.value<uint64_t>();
+        used = r.value<uint64_t>();
+        r.array(slots);
+    }
+private:
+    enum : uint8_t { empty_slot, full_slot, erased_slot };
+    struct slot {
+        K key;
+        V value;
+        uint8_t state = empty_slot;
+    };
+
+    size_t mask() const { return slots.size() - 1; }
+    // Hashes are mixed before they're masked, since std::hash leaves integers as they are and the low bits alone
+    // would pile keys that only differ higher up into one long probe
+    size_t home(const K& k) const {
+        uint64_t h = uint64_t(Hash()(k)) * 0x9e3779b97f4a7c15ull;
+        return size_t(h ^ h >> 32) & mask();
+    }
+    void rehash(size_t capacity) {
+        std::vector<slot> previous = std::move(slots);
+        slots.assign(capacity, slot{});
+        used = count;
+        for (const slot& s : previous) {
+            if (s.state != full_slot)
+                continue;
+            size_t i = home(s.key);
+            while (slots[i].state == full_slot)
+                i = (i + 1) & mask();
+            slots[i] = s;
+        }
+    }
+
+    std::vector<slot> slots; // a power of two of them, or none
+    size_t count = 0;        // full slots
+    size_t used = 0;         // full slots and tombstones
+};
+
+#endif //FLAT_HASH_MAP_H
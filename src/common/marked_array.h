@@ -3,10 +3,15 @@
 
 #include <common/bit.h>
 #include <common/assertion.h>
+#include <common/raii_types.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <vector>
 
 template <typename storage_t, typename marking_t>
 class marked_storage {
@@ -60,7 +65,7 @@ template <typename element, unsigned size>
 class marked_array : public marked_storage<std::array<element, size>, bitarray<size>> {};
 
 template <typename element>
-class marked_vector : public marked_storage<std::vector<element>, bitvector> {
+class marked_vector : public marked_storage<std::vector<element>, hierarchical_bitset> {
 public:
     marked_vector() = default;
     marked_vector(size_t size) { set_capacity(size); }
@@ -82,4 +87,256 @@ public:
     }
 };
 
+// A marked_vector split into pages, that any number of threads can insert into and remove from at once, without locks.
+// A slot is claimed by atomically setting its bit in the page's `claimed` words; the claiming thread then writes the
+// element and sets its `published` bit with release ordering, and exists() only reports published elements.
+// Pages are reached through a directory of segments, segment s holding the pointers to 2^s pages, so growing just
+// installs a new page (and every so often a new segment) with a compare-and-swap and nothing is ever moved.
+// Two threads writing or removing the same id at once is still a race.
+template <typename element, size_t page_size = 256>
+class concurrent_marked_vector : public no_copy, no_move {
+    static_assert(page_size % 64 == 0, "Pages hold whole marker words");
+public:
+    concurrent_marked_vector() = default;
+    concurrent_marked_vector(size_t size) { set_capacity(size); }
+    ~concurrent_marked_vector() {
+        for (size_t s = 0; s < num_segments; s++) {
+            std::atomic<page*>* segment = segments[s].load();
+            if (!segment)
+                break;
+            for (size_t i = 0; i < segment_size(s); i++)
+                delete segment[i].load();
+            delete[] segment;
+        }
+    }
+
+    bool exists(size_t id) const {
+        if (id >= capacity())
+            return false;
+        const page& pg = page_at(id / page_size);
+        return pg.published[word_of(id)].load(std::memory_order_acquire) & bit_of(id);
+    }
+    element& operator[] (size_t id) const {
+        assertion(exists(id), "Cannot access unmarked element");
+        return page_at(id / page_size).items[id % page_size];
+    }
+    size_t size() const { return count.load(); }
+    size_t capacity() const { return num_pages.load(std::memory_order_acquire) * page_size; }
+    void set_capacity(size_t new_size) {
+        for (size_t n = num_pages.load(); n * page_size < new_size; n = num_pages.load())
+            add_page(n);
+    }
+
+    // Claims the lowest free slot, starting from the first page that might have one
+    size_t insert_any(const element& e) {
+        for (size_t p = open_hint.load(); ; p = open_hint.load()) {
+            size_t n = num_pages.load(std::memory_order_acquire);
+            if (p >= n) {
+                add_page(n);
+                continue;
+            }
+            page& pg = page_at(p);
+            for (size_t w = 0; w < words_per_page; w++) {
+                uint64_t claimed = pg.claimed[w].load(std::memory_order_relaxed);
+                while (~claimed) {
+                    uint64_t bit = ~claimed & (claimed + 1); // lowest clear bit
+                    claimed = pg.claimed[w].fetch_or(bit, std::memory_order_acq_rel);
+                    if (!(claimed & bit)) {
+                        size_t id = p * page_size + w * 64 + std::countr_zero(bit);
+                        publish(pg, id, e);
+                        return id;
+                    }
+                }
+            }
+            // Full as far as this thread saw, so later inserts can start past it. A remove on this page that came
+            // before the hint moved won't have lowered it, so look again afterwards and put the hint back if a slot
+            // has opened up. Either way the next page to try is wherever the hint is now, not p + 1.
+            size_t expected = p;
+            if (open_hint.compare_exchange_strong(expected, p + 1) && has_free(pg))
+                lower_hint(p);
+        }
+    }
+    // Writes to a specific id, claiming it first if it's free
+    element& insert(size_t id, const element& e) {
+        set_capacity(id + 1);
+        page& pg = page_at(id / page_size);
+        if (pg.claimed[word_of(id)].fetch_or(bit_of(id), std::memory_order_acq_rel) & bit_of(id)) {
+            pg.items[id % page_size] = e;
+            return pg.items[id % page_size];
+        }
+        return publish(pg, id, e);
+    }
+    void remove(size_t id) {
+        if (!exists(id))
+            return;
+        page& pg = page_at(id / page_size);
+        if (!(pg.published[word_of(id)].fetch_and(~bit_of(id), std::memory_order_acq_rel) & bit_of(id)))
+            return;
+        count.fetch_sub(1);
+        // sequentially consistent, so either this sees an insert_any's move of the hint past the page or that
+        // insert_any's second look sees the slot free
+        pg.claimed[word_of(id)].fetch_and(~bit_of(id));
+        lower_hint(id / page_size);
+    }
+
+    // Visits published elements in id order. Elements published or removed during iteration may or may not be seen.
+    class iterator {
+    public:
+        size_t index() const { return id; }
+        bool operator!=(const iterator& rhs) const { return id != rhs.id; }
+        bool operator==(const iterator& rhs) const { return id == rhs.id; }
+        element& operator*() { return (*ctr)[id]; }
+        iterator operator++() {
+            id = ctr->next_published(id + 1);
+            return *this;
+        }
+    private:
+        iterator(const concurrent_marked_vector* ctr, size_t id) : ctr(ctr), id(id) {}
+
+        const concurrent_marked_vector* ctr = nullptr;
+        size_t id = 0;
+        friend class concurrent_marked_vector;
+    };
+
+    iterator begin() const { return iterator(this, next_published(0)); }
+    iterator end() const { return iterator(this, SIZE_MAX); }
+private:
+    constexpr static size_t words_per_page = page_size / 64;
+    constexpr static size_t num_segments = 48; // 2^48 - 1 pages, more than can ever be allocated
+    struct page {
+        std::array<std::atomic<uint64_t>, words_per_page> claimed{};
+        std::array<std::atomic<uint64_t>, words_per_page> published{};
+        std::array<element, page_size> items;
+    };
+
+    static size_t word_of(size_t id) { return id % page_size / 64; }
+    static uint64_t bit_of(size_t id) { return uint64_t(1) << (id % 64); }
+    static size_t segment_size(size_t s) { return size_t(1) << s; }
+    // page p lives in segment s = floor(log2(p + 1)), at p + 1 - 2^s
+    static size_t segment_of(size_t p) { return std::bit_width(p + 1) - 1; }
+
+    // Only valid for pages below num_pages, which are always installed
+    page& page_at(size_t p) const {
+        size_t s = segment_of(p);
+        return *segments[s].load(std::memory_order_acquire)[p + 1 - segment_size(s)].load(std::memory_order_acquire);
+    }
+    bool has_free(const page& pg) const {
+        for (size_t w = 0; w < words_per_page; w++) {
+            if (~pg.claimed[w].load())
+                return true;
+        }
+        return false;
+    }
+    void lower_hint(size_t p) {
+        size_t hint = open_hint.load();
+        while (p < hint && !open_hint.compare_exchange_weak(hint, p));
+    }
+
+    element& publish(page& pg, size_t id, const element& e) {
+        pg.items[id % page_size] = e;
+        pg.published[word_of(id)].fetch_or(bit_of(id), std::memory_order_release);
+        count.fetch_add(1);
+        return pg.items[id % page_size];
+    }
+    // Installs page `n` (and its segment) if nobody has yet, then makes sure num_pages counts it; losers of any of
+    // these races just help
+    void add_page(size_t n) {
+        size_t s = segment_of(n);
+        assertion(s < num_segments, "concurrent_marked_vector is out of pages");
+        std::atomic<page*>* segment = segments[s].load(std::memory_order_acquire);
+        if (!segment) {
+            std::atomic<page*>* fresh = new std::atomic<page*>[segment_size(s)]();
+            if (segments[s].compare_exchange_strong(segment, fresh, std::memory_order_acq_rel))
+                segment = fresh;
+            else
+                delete[] fresh;
+        }
+        std::atomic<page*>& slot = segment[n + 1 - segment_size(s)];
+        if (!slot.load(std::memory_order_acquire)) {
+            page* expected = nullptr;
+            page* fresh = new page;
+            if (!slot.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel))
+                delete fresh;
+        }
+        size_t current = n;
+        num_pages.compare_exchange_strong(current, n + 1, std::memory_order_acq_rel);
+    }
+    // the first published id at or after `id`, or SIZE_MAX
+    size_t next_published(size_t id) const {
+        size_t n = num_pages.load(std::memory_order_acquire);
+        for (size_t p = id / page_size; p < n; p++) {
+            const page& pg = page_at(p);
+            for (size_t w = p == id / page_size ? word_of(id) : 0; w < words_per_page; w++) {
+                uint64_t bits = pg.published[w].load(std::memory_order_acquire);
+                if (p == id / page_size && w == word_of(id))
+                    bits &= ~(bit_of(id) - 1);
+                if (bits)
+                    return p * page_size + w * 64 + std::countr_zero(bits);
+            }
+        }
+        return SIZE_MAX;
+    }
+
+    std::array<std::atomic<std::atomic<page*>*>, num_segments> segments{};
+    std::atomic<size_t> num_pages = 0;
+    std::atomic<size_t> open_hint = 0; // no page below this has a free slot, give or take inserts in flight
+    std::atomic<size_t> count = 0;
+};
+
+// Like marked_vector, but only live elements are stored, packed in id order. An id's slot is the number of live ids
+// below it, which the rank index answers in O(1), so memory follows the number of elements instead of the largest id.
+// Inserting or removing shifts every element above it, so this suits tables that are read far more than they change.
+template <typename element>
+class compact_marked_vector {
+public:
+    compact_marked_vector() = default;
+    compact_marked_vector(size_t size) { set_capacity(size); }
+
+    bool exists(size_t id) const { return id < markers.capacity() && markers.get(id); }
+    void remove(size_t id) {
+        if (!exists(id))
+            return;
+        data.erase(data.begin() + markers.rank(id));
+        markers.clear(id);
+    }
+    element& insert(size_t id, const element& e) {
+        if (id >= markers.capacity())
+            set_capacity(std::max(id + 1, markers.capacity() * 2));
+        size_t slot = markers.rank(id);
+        if (markers.get(id))
+            return data[slot] = e;
+        markers.set(id);
+        return *data.insert(data.begin() + slot, e);
+    }
+
+    element& operator[] (size_t id) const {
+        assertion(exists(id), "Cannot access unmarked element");
+        return (element&) data[markers.rank(id)];
+    }
+    // the id of the element at `slot`, in id order
+    size_t id_at(size_t slot) const { return markers.select(slot); }
+
+    size_t size() const { return data.size(); }
+    size_t capacity() const { return markers.capacity(); }
+    void set_capacity(size_t new_size) { markers.resize(new_size); }
+    unsigned first_free_id() const { return markers.least_unset_bit(); }
+    size_t find_spot() {
+        if (first_free_id() == capacity())
+            set_capacity(capacity() * 2 + 1);
+        return first_free_id();
+    }
+    size_t insert_any(const element& e) {
+        size_t spot = find_spot();
+        insert(spot, e);
+        return spot;
+    }
+
+    // live elements, in id order
+    element* begin() { return data.data(); }
+    element* end() { return data.data() + data.size(); }
+private:
+    ranked_bitvector markers;
+    std::vector<element> data;
+};
+
 #endif //BIT_TYPES_H
@@ -0,0 +1,94 @@
+#ifndef PAGED_VECTOR_H
+#define PAGED_VECTOR_H
+
+#include <common/assertion.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// A vector kept in fixed pages of page_size elements. Growing adds a page and never moves what's already there, so
+// references to elements stay valid until those elements are popped, and a large pool never pays for copying all
+// of itself at once. Each page is contiguous, so it can be walked or copied as one block.
+template <typename T, size_t page_size = 1024>
+class paged_vector {
+    static_assert(std::has_single_bit(page_size), "Pages are indexed by shifting");
+    constexpr static size_t page_shift = std::countr_zero(page_size);
+public:
+    paged_vector() = default;
+    paged_vector(const paged_vector&) = delete;
+    paged_vector(paged_vector&& other) noexcept
+        : pages(std::move(other.pages)), _size(std::exchange(other._size, 0)) {}
+    ~paged_vector() {
+        clear();
+        for (T* p : pages)
+            std::allocator<T>().deallocate(p, page_size);
+    }
+    paged_vector& operator=(const paged_vector&) = delete;
+    paged_vector& operator=(paged_vector&& other) noexcept {
+        std::swap(pages, other.pages);
+        std::swap(_size, other._size);
+        return *this;
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    T& operator[] (size_t i) const { return pages[i >> page_shift][i & (page_size - 1)]; }
+    T& back() const { return (*this)[_size - 1]; }
+
+    template <typename... Args> T& emplace_back(Args&&... args) {
+        if (_size == pages.size() * page_size)
+            pages.emplace_back(std::allocator<T>().allocate(page_size));
+        T* e = new (&(*this)[_size]) T(std::forward<Args>(args)...);
+        _size++;
+        return *e;
+    }
+    void pop_back() {
+        back().~T();
+        _size--;
+    }
+    // Pages are kept for reuse, so a vector that's emptied and refilled to the same size doesn't allocate
+    void clear() {
+        while (_size > 0)
+            pop_back();
+    }
+    void resize(size_t n) {
+        while (_size > n)
+            pop_back();
+        while (_size < n)
+            emplace_back();
+    }
+
+    // calls f(T* first, size_t count) for each page's run of elements, in order
+    template <typename F> void for_each_block(F&& f) const {
+        for (size_t first = 0; first < _size; first += page_size)
+            f(pages[first >> page_shift], std::min(page_size, _size - first));
+    }
+
+    class iterator {
+    public:
+        T& operator*() const { return (*v)[i]; }
+        bool operator!=(const iterator& rhs) const { return i != rhs.i; }
+        iterator& operator++() {
+            i++;
+            return *this;
+        }
+    private:
+        iterator(const paged_vector* v, size_t i) : v(v), i(i) {}
+
+        const paged_vector* v;
+        size_t i;
+        friend class paged_vector;
+    };
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, _size); }
+private:
+    std::vector<T*> pages;
+    size_t _size = 0;
+};
+
+#endif //PAGED_VECTOR_H
@@ -0,0 +1,89 @@
+#ifndef SKYLINE_PACKER_H
+#define SKYLINE_PACKER_H
+
+#include <common/coordinate_types.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Packs rectangles into a fixed-size area using the skyline bottom-left heuristic. The top edge of everything placed
+// so far is kept as a list of horizontal segments. Each new rectangle goes wherever its bottom edge ends up highest
+// (lowest y+h), with ties going to the narrower segment. That wastes little space when most rectangles are of similar
+// sizes, such as sprite sheets.
+class skyline_packer {
+public:
+    skyline_packer(uint16_t width, uint16_t height) : _width(width), _height(height), skyline{{0, 0, width}} {}
+
+    // Finds room for a w x h rectangle and claims it, or returns false if there's nowhere it fits
+    bool pack(uint16_t w, uint16_t h, vec2<uint16_t>& pos) {
+        size_t best = SIZE_MAX;
+        uint32_t best_bottom = UINT32_MAX, best_width = UINT32_MAX, best_y = 0;
+        for (size_t i = 0; i < skyline.size(); i++) {
+            uint32_t y;
+            if (!fit(i, w, h, y))
+                continue;
+            if (y + h < best_bottom || (y + h == best_bottom && skyline[i].width < best_width)) {
+                best = i;
+                best_bottom = y + h;
+                best_width = skyline[i].width;
+                best_y = y;
+            }
+        }
+        if (best == SIZE_MAX)
+            return false;
+
+        pos = vec2<uint16_t>{skyline[best].x, uint16_t(best_y)};
+        skyline.insert(skyline.begin() + best, segment{skyline[best].x, uint16_t(best_bottom), w});
+        // trim the segments the new one now covers
+        for (size_t i = best + 1; i < skyline.size();) {
+            uint32_t covered_to = skyline[i - 1].x + skyline[i - 1].width;
+            if (skyline[i].x >= covered_to)
+                break;
+            uint32_t overlap = covered_to - skyline[i].x;
+            if (overlap < skyline[i].width) {
+                skyline[i].x += overlap;
+                skyline[i].width -= overlap;
+                break;
+            }
+            skyline.erase(skyline.begin() + i);
+        }
+        // neighbours at the same height become one segment
+        for (size_t i = 1; i < skyline.size();) {
+            if (skyline[i - 1].y == skyline[i].y) {
+                skyline[i - 1].width += skyline[i].width;
+                skyline.erase(skyline.begin() + i);
+            } else {
+                i++;
+            }
+        }
+        return true;
+    }
+
+    uint16_t width() const { return _width; }
+    uint16_t height() const { return _height; }
+private:
+    struct segment {
+        uint16_t x, y, width;
+    };
+
+    // Whether a w x h rectangle with its left edge on segment i stays inside the area, and if so, the y it rests at:
+    // the highest of the segments it spans
+    bool fit(size_t i, uint16_t w, uint16_t h, uint32_t& y) const {
+        if (uint32_t(skyline[i].x) + w > _width)
+            return false;
+        y = 0;
+        for (uint32_t spanned = 0; spanned < w; i++) {
+            y = std::max<uint32_t>(y, skyline[i].y);
+            if (y + h > _height)
+                return false;
+            spanned += skyline[i].width;
+        }
+        return true;
+    }
+
+    uint16_t _width, _height;
+    std::vector<segment> skyline; // left to right, covering the whole width
+};
+
+#endif //SKYLINE_PACKER_H
@@ -0,0 +1,151 @@
+#ifndef SMALL_VECTOR_H
+#define SMALL_VECTOR_H
+
+#include <common/assertion.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <type_traits>
+
+// A vector that keeps up to N elements inside itself, and only moves them to the heap once it grows past that.
+// Meant for components that almost always hold one or two things, so walking a pool of them stays in the pool's own
+// memory. Elements are moved around with memcpy, so they must be trivially copyable.
+template <typename T, size_t N>
+class small_vector {
+    static_assert(std::is_trivially_copyable_v<T>, "small_vector elements are copied as raw memory");
+    static_assert(N > 0);
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    small_vector() = default;
+    small_vector(std::initializer_list<T> init) { assign(init.begin(), init.end()); }
+    small_vector(const small_vector& other) { assign(other.begin(), other.end()); }
+    small_vector(small_vector&& other) noexcept { take(other); }
+    ~small_vector() { release(); }
+
+    small_vector& operator=(const small_vector& other) {
+        if (this != &other)
+            assign(other.begin(), other.end());
+        return *this;
+    }
+    small_vector& operator=(small_vector&& other) noexcept {
+        if (this != &other) {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+    bool empty() const { return _size == 0; }
+    // whether the elements have spilled out to the heap
+    bool on_heap() const { return _capacity > N; }
+
+    T* data() { return on_heap() ? storage.heap : (T*) storage.local; }
+    const T* data() const { return on_heap() ? storage.heap : (const T*) storage.local; }
+    T* begin() { return data(); }
+    T* end() { return data() + _size; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + _size; }
+
+    T& operator[] (size_t i) { return data()[i]; }
+    const T& operator[] (size_t i) const { return data()[i]; }
+    T& front() { return data()[0]; }
+    T& back() { return data()[_size - 1]; }
+
+    void reserve(size_t n) {
+        if (n <= _capacity)
+            return;
+        T* grown = (T*) malloc(n * sizeof(T));
+        if (!grown)
+            throw std::bad_alloc();
+        memcpy(grown, data(), _size * sizeof(T));
+        if (on_heap())
+            free(storage.heap);
+        storage.heap = grown;
+        _capacity = n;
+    }
+    void resize(size_t n) {
+        reserve(n);
+        for (size_t i = _size; i < n; i++)
+            data()[i] = T();
+        _size = n;
+    }
+    void clear() { _size = 0; }
+
+    T& push_back(const T& e) { return emplace_back(e); }
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        // built first, since `args` may refer to an element that's about to be moved by growing
+        T e(std::forward<Args>(args)...);
+        if (_size == _capacity)
+            reserve(_capacity * 2);
+        return data()[_size++] = e;
+    }
+    void pop_back() {
+        assertion(_size > 0, "Cannot pop from an empty small_vector");
+        _size--;
+    }
+
+    template <typename It>
+    void assign(It first, It last) {
+        size_t n = std::distance(first, last);
+        clear();
+        reserve(n);
+        std::copy(first, last, data());
+        _size = n;
+    }
+
+    bool operator==(const small_vector& rhs) const { return std::equal(begin(), end(), rhs.begin(), rhs.end()); }
+
+    // For restoring snapshots, which copy whole arrays of small_vectors as raw bytes. An inline one is complete once
+    // its bytes are back, but a spilled one still points at the heap block of the vector it was copied from. This
+    // gives it a block of its own, which the caller fills with its size() elements, and must only be called then.
+    T* detach_heap() {
+        if (!on_heap())
+            return data();
+        storage.heap = (T*) malloc(_capacity * sizeof(T));
+        if (!storage.heap) {
+            _capacity = N;
+            _size = 0;
+            throw std::bad_alloc();
+        }
+        return storage.heap;
+    }
+private:
+    void release() {
+        if (on_heap())
+            free(storage.heap);
+        _capacity = N;
+        _size = 0;
+    }
+    // steals `other`'s heap block if it has one, leaving it empty
+    void take(small_vector& other) {
+        _size = other._size;
+        _capacity = other._capacity;
+        if (other.on_heap())
+            storage.heap = other.storage.heap;
+        else
+            memcpy(storage.local, other.storage.local, _size * sizeof(T));
+        other._capacity = N;
+        other._size = 0;
+    }
+
+    uint32_t _size = 0;
+    uint32_t _capacity = N;
+    union {
+        alignas(T) unsigned char local[N * sizeof(T)];
+        T* heap;
+    } storage;
+};
+
+#endif //SMALL_VECTOR_H
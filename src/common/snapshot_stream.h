@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_STREAM_H
+#define SNAPSHOT_STREAM_H
+
+#include <common/assertion.h>
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Appends raw memory to a byte buffer. Only trivially copyable types go in directly; anything holding pointers
+// has to be written out field by field. The buffer keeps its capacity between uses, so a reused buffer
+// stops allocating once it's grown to the size of a typical snapshot.
+class snapshot_writer {
+public:
+    snapshot_writer(std::vector<uint8_t>& out) : out(out) {}
+
+    void write(const void* data, size_t bytes) {
+        const uint8_t* p = (const uint8_t*) data;
+        out.insert(out.end(), p, p + bytes);
+    }
+    template <typename T> void value(const T& v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write(&v, sizeof(T));
+    }
+    // any contiguous container with data() and size(), such as std::vector or small_vector
+    template <typename C> void array(const C& v) {
+        static_assert(std::is_trivially_copyable_v<typename C::value_type>);
+        value<uint64_t>(v.size());
+        write(v.data(), v.size() * sizeof(typename C::value_type));
+    }
+private:
+    std::vector<uint8_t>& out;
+};
+
+// Reads back what a snapshot_writer wrote, in the same order
+class snapshot_reader {
+public:
+    snapshot_reader(const std::vector<uint8_t>& in) : in(in) {}
+
+    void read(void* data, size_t bytes) {
+        assertion(pos + bytes <= in.size(), "Snapshot read past the end");
+        if (bytes) // an empty container may have no memory to copy into at all
+            memcpy(data, in.data() + pos, bytes);
+        pos += bytes;
+    }
+    template <typename T> void value(T& v) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        read(&v, sizeof(T));
+    }
+    template <typename T> T value() {
+        T v;
+        value(v);
+        return v;
+    }
+    template <typename C> void array(C& v) {
+        static_assert(std::is_trivially_copyable_v<typename C::value_type>);
+        v.resize(value<uint64_t>());
+        read(v.data(), v.size() * sizeof(typename C::value_type));
+    }
+private:
+    const std::vector<uint8_t>& in;
+    size_t pos = 0;
+};
+
+#endif //SNAPSHOT_STREAM_H
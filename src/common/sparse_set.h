@@ -0,0 +1,131 @@
+#ifndef SPARSE_SET_H
+#define SPARSE_SET_H
+
+#include <common/assertion.h>
+#include <common/bit.h>
+#include <common/paged_vector.h>
+#include <common/snapshot_stream.h>
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Maps ids to elements packed contiguously in memory. Iterating visits only live elements, in no particular order.
+// Removal swaps the last element into the removed one's place, so it invalidates references to that last element,
+// and removing elements other than the current one while iterating will skip over elements. Adding elements never
+// moves the others, as they're kept in pages.
+// Each element also carries a tick, for owners to record when it last changed; it starts at 0.
+template <typename T>
+class sparse_set {
+public:
+    using element = T;
+    constexpr static uint32_t npos = UINT32_MAX;
+
+    bool exists(size_t id) const { return id < sparse.size() && sparse[id] != npos; }
+    T& insert(size_t id, const T& e) {
+        if (exists(id))
+            return dense[sparse[id]] = e;
+        if (id >= sparse.size())
+            sparse.resize(id + 1, npos);
+        if (id >= _markers.capacity())
+            _markers.resize(std::max(id + 1, _markers.capacity() * 2));
+
+        sparse[id] = dense.size();
+        _markers.set(id);
+        ids.emplace_back(id);
+        _ticks.emplace_back(0);
+        return dense.emplace_back(e);
+    }
+    void remove(size_t id) {
+        if (!exists(id))
+            return;
+        uint32_t idx = sparse[id];
+        if (idx != dense.size() - 1) {
+            dense[idx] = std::move(dense.back());
+            ids[idx] = ids.back();
+            _ticks[idx] = _ticks.back();
+            sparse[ids[idx]] = idx;
+        }
+        dense.pop_back();
+        ids.pop_back();
+        _ticks.pop_back();
+        sparse[id] = npos;
+        _markers.clear(id);
+    }
+
+    T& operator[] (size_t id) const {
+        assertion(exists(id), "Cannot access unmarked element");
+        return (T&) dense[sparse[id]];
+    }
+
+    // exchanges the elements at two positions in iteration order, for owners that keep them partitioned
+    void swap_positions(size_t i, size_t j) {
+        if (i == j)
+            return;
+        std::swap(dense[i], dense[j]);
+        std::swap(ids[i], ids[j]);
+        std::swap(_ticks[i], _ticks[j]);
+        sparse[ids[i]] = i;
+        sparse[ids[j]] = j;
+    }
+    // where `id`'s element sits in iteration order
+    size_t index(size_t id) const {
+        assertion(exists(id), "Cannot access unmarked element");
+        return sparse[id];
+    }
+    size_t size() const { return dense.size(); }
+    // the id of each element, in iteration order
+    const std::vector<uint32_t>& entities() const { return ids; }
+    // one bit per id, set if that id has an element
+    const hierarchical_bitset& markers() const { return _markers; }
+    // each element's tick, in iteration order
+    const std::vector<uint32_t>& ticks() const { return _ticks; }
+    void set_tick(size_t id, uint32_t tick) { _ticks[index(id)] = tick; }
+
+    // the element at position `i` in iteration order
+    T& at(size_t i) const { return dense[i]; }
+    typename paged_vector<T>::iterator begin() const { return dense.begin(); }
+    typename paged_vector<T>::iterator end() const { return dense.end(); }
+
+    // Elements are copied a page at a time. Ones that aren't trivially copyable must still be safe to copy as raw bytes,
+    // apart from whatever they keep on the heap: that's written after the block by `save_spilled(snapshot_writer&,
+    // const T&)`, and put back by `load_spilled(snapshot_reader&, T&)` once the block is in place. Both overloads are
+    // found by argument-dependent lookup.
+    void save(snapshot_writer& w) const {
+        w.array(ids);
+        w.array(sparse);
+        _markers.save(w);
+        w.value<uint64_t>(dense.size());
+        dense.for_each_block([&](const T* first, size_t n) { w.write(first, n * sizeof(T)); });
+        if constexpr (!std::is_trivially_copyable_v<T>) {
+            for (const T& e : dense)
+                save_spilled(w, e);
+        }
+    }
+    // Change ticks aren't saved; every loaded element is stamped with `tick` instead, as all of them may have changed
+    void load(snapshot_reader& r, uint32_t tick) {
+        r.array(ids);
+        r.array(sparse);
+        _markers.load(r);
+        size_t n = r.value<uint64_t>();
+        // emptied first, so nothing the blocks overwrite still owns memory
+        if constexpr (!std::is_trivially_copyable_v<T>)
+            dense.clear();
+        dense.resize(n);
+        dense.for_each_block([&](T* first, size_t count) { r.read((void*) first, count * sizeof(T)); });
+        if constexpr (!std::is_trivially_copyable_v<T>) {
+            for (T& e : dense)
+                load_spilled(r, e);
+        }
+        _ticks.assign(ids.size(), tick);
+    }
+private:
+    paged_vector<T> dense;
+    std::vector<uint32_t> ids;
+    std::vector<uint32_t> sparse; // id -> index into `dense`, grown on demand up to the largest id inserted
+    std::vector<uint32_t> _ticks;
+    hierarchical_bitset _markers;
+};
+
+#endif //SPARSE_SET_H
@@ -18,7 +18,7 @@ private:
 };
 
 template <typename T>
-size_t stopwatch::elapsed() { return std::chrono::duration_cast<T>(std::chrono::steady_clock::now() - _start).count(); }
-void stopwatch::start() { _start = std::chrono::steady_clock::now(); }
+inline size_t stopwatch::elapsed() { return std::chrono::duration_cast<T>(std::chrono::steady_clock::now() - _start).count(); }
+inline void stopwatch::start() { _start = std::chrono::steady_clock::now(); }
 
 #endif //STOPWATCH_H
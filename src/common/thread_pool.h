@@ -0,0 +1,186 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <common/aligned_allocator.h>
+#include <common/raii_types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of worker threads, each with its own deque of jobs. Workers pop their own newest job first, and when
+// they run dry they steal the oldest job from a random other worker. Jobs submitted from inside a job go onto the
+// submitting worker's deque, so nested work stays on the core whose cache it was made on.
+class thread_pool : public no_copy, no_move {
+public:
+    using job = std::function<void()>;
+    constexpr static size_t cache_line = cache_line_size;
+
+    thread_pool(size_t num_threads = std::thread::hardware_concurrency()) : queues(std::max<size_t>(num_threads, 1)) {
+        for (size_t i = 0; i < queues.size(); i++)
+            threads.emplace_back([this, i] { worker(i); });
+    }
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    size_t size() const { return threads.size(); }
+    // the calling thread's index among the workers, or size() if it isn't one of them
+    size_t current_worker() const { return current_owner == this ? current_index : size(); }
+    void submit(job j) {
+        size_t q = current_owner == this ? current_index : next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        // counted before it's pushed, so `pending` never drops below the number of jobs actually queued
+        pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(queues[q].mutex);
+            queues[q].jobs.emplace_back(std::move(j));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+        }
+        wake.notify_one();
+    }
+
+    // Runs one queued job on the calling thread, if there are any. Lets a thread that's waiting on other jobs help
+    // finish them instead of blocking, which also means jobs can safely wait on jobs they submitted.
+    bool run_one() {
+        job j;
+        if (!take(current_owner == this ? current_index : SIZE_MAX, j))
+            return false;
+        j();
+        return true;
+    }
+
+    // Calls f(lo, hi) over [begin, end) split into chunks of `grain` indices, and returns once all of them are done.
+    // The calling thread runs the first chunk itself, then helps with the rest. Exceptions are rethrown here.
+    // A grain of 0 gives each worker chunks_per_thread chunks. If the indices are into arrays of T that start on a
+    // cache line, such as those from cache_aligned_allocator, the grain and the chunk bounds are rounded to whole
+    // cache lines of T, so no two chunks ever write to the same line.
+    template <typename T = void, typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F&& f) {
+        if (begin >= end)
+            return;
+        constexpr size_t line = [] {
+            if constexpr (std::is_void_v<T>)
+                return size_t(1);
+            else
+                return std::max<size_t>(cache_line / sizeof(T), 1);
+        }();
+        size_t base = begin / line * line;
+        if (grain == 0) {
+            size_t target = size() * chunks_per_thread;
+            grain = (end - base + target - 1) / target;
+        }
+        grain = (std::max<size_t>(grain, 1) + line - 1) / line * line;
+        size_t chunks = (end - base + grain - 1) / grain;
+        if (chunks == 1)
+            return f(begin, end);
+
+        std::atomic<size_t> remaining = chunks - 1;
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto run_chunk = [&](size_t c) {
+            try {
+                f(std::max(begin, base + c * grain), std::min(end, base + (c + 1) * grain));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        };
+        for (size_t c = 1; c < chunks; c++) {
+            submit([&, c] {
+                run_chunk(c);
+                remaining.fetch_sub(1);
+            });
+        }
+        run_chunk(0);
+        while (remaining.load() > 0) {
+            if (!run_one())
+                std::this_thread::yield();
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    // when parallel_for picks the grain, more chunks than threads, so there's something left to steal when chunks
+    // take uneven amounts of time
+    constexpr static size_t chunks_per_thread = 4;
+
+    struct alignas(cache_line) work_queue {
+        std::mutex mutex;
+        std::deque<job> jobs;
+    };
+
+    // Pops from the back of `own` if it's a valid index, otherwise steals from the front of a random queue
+    bool take(size_t own, job& out) {
+        if (own < queues.size()) {
+            std::lock_guard<std::mutex> lock(queues[own].mutex);
+            if (!queues[own].jobs.empty()) {
+                out = std::move(queues[own].jobs.back());
+                queues[own].jobs.pop_back();
+                pending.fetch_sub(1);
+                return true;
+            }
+        }
+        thread_local std::minstd_rand rng(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        size_t start = rng() % queues.size();
+        for (size_t k = 0; k < queues.size(); k++) {
+            work_queue& victim = queues[(start + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                out = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                pending.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker(size_t index) {
+        current_owner = this;
+        current_index = index;
+        for (;;) {
+            job j;
+            if (take(index, j)) {
+                j();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || pending.load() > 0; });
+            if (stopping && pending.load() == 0)
+                return;
+        }
+    }
+
+    // which pool the current thread works for, if any, and its queue in that pool
+    static inline thread_local const thread_pool* current_owner = nullptr;
+    static inline thread_local size_t current_index = 0;
+
+    std::vector<work_queue> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_queue = 0;
+    std::atomic<size_t> pending = 0; // jobs sitting in any queue, so idle workers know whether to sleep
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+#endif //THREAD_POOL_H
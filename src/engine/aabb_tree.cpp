@@ -0,0 +1,236 @@
+#include "aabb_tree.h"
+#include <common/assertion.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace ecs {
+
+    static aabb<int32_t> combine(const aabb<int32_t>& a, const aabb<int32_t>& b) {
+        return aabb<int32_t>{
+            vec2<int32_t>{std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y)},
+            vec2<int32_t>{std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y)}
+        };
+    }
+
+    static bool contains(const aabb<int32_t>& outer, const aabb<int32_t>& inner) {
+        return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y
+            && outer.max.x >= inner.max.x && outer.max.y >= inner.max.y;
+    }
+
+    static int64_t perimeter(const aabb<int32_t>& box) {
+        return 2 * (int64_t(box.max.x - box.min.x) + int64_t(box.max.y - box.min.y));
+    }
+
+    static aabb<int32_t> fatten(const aabb<int32_t>& box) {
+        constexpr int32_t m = aabb_tree::fat_margin;
+        return aabb<int32_t>{vec2<int32_t>{box.min.x - m, box.min.y - m}, vec2<int32_t>{box.max.x + m, box.max.y + m}};
+    }
+
+
+    aabb_tree::proxy aabb_tree::insert(const aabb<int32_t>& box, hitbox_ref data) {
+        uint32_t leaf = allocate_node();
+        nodes[leaf].box = fatten(box);
+        nodes[leaf].tight = box;
+        nodes[leaf].data = data;
+        insert_leaf(leaf);
+        return leaf;
+    }
+
+    void aabb_tree::remove(proxy p) {
+        assertion(p < nodes.size() && nodes[p].leaf(), "Cannot remove a nonexistent proxy");
+        remove_leaf(p);
+        free_node(p);
+    }
+
+    bool aabb_tree::move(proxy p, const aabb<int32_t>& box) {
+        assertion(p < nodes.size() && nodes[p].leaf(), "Cannot move a nonexistent proxy");
+        nodes[p].tight = box;
+        if (contains(nodes[p].box, box))
+            return false;
+
+        remove_leaf(p);
+        nodes[p].box = fatten(box);
+        insert_leaf(p);
+        return true;
+    }
+
+
+    uint32_t aabb_tree::allocate_node() {
+        if (free_list == null_node) {
+            nodes.emplace_back();
+            return nodes.size() - 1;
+        }
+        uint32_t n = free_list;
+        free_list = nodes[n].parent;
+        nodes[n] = node();
+        return n;
+    }
+
+    void aabb_tree::free_node(uint32_t n) {
+        nodes[n].parent = free_list;
+        nodes[n].height = -1;
+        free_list = n;
+    }
+
+    // Walk from `n` to the root, rebalancing and recomputing bounds along the way
+    void aabb_tree::refit(uint32_t n) {
+        while (n != null_node) {
+            n = balance(n);
+            node& current = nodes[n];
+            current.height = 1 + std::max(nodes[current.left].height, nodes[current.right].height);
+            current.box = combine(nodes[current.left].box, nodes[current.right].box);
+            n = current.parent;
+        }
+    }
+
+    void aabb_tree::insert_leaf(uint32_t leaf) {
+        if (root == null_node) {
+            root = leaf;
+            nodes[root].parent = null_node;
+            return;
+        }
+
+        // Descend towards the sibling that minimizes the growth in total perimeter
+        aabb<int32_t> leaf_box = nodes[leaf].box;
+        uint32_t sibling = root;
+        while (!nodes[sibling].leaf()) {
+            const node& n = nodes[sibling];
+            int64_t area = perimeter(n.box);
+            int64_t combined_area = perimeter(combine(n.box, leaf_box));
+            // cost of making a new parent for this node and the leaf, and the cost pushed down to the children
+            int64_t cost = 2 * combined_area;
+            int64_t inheritance_cost = 2 * (combined_area - area);
+
+            auto descend_cost = [&](uint32_t child) {
+                int64_t new_area = perimeter(combine(leaf_box, nodes[child].box));
+                if (nodes[child].leaf())
+                    return new_area + inheritance_cost;
+                return new_area - perimeter(nodes[child].box) + inheritance_cost;
+            };
+            int64_t cost_left = descend_cost(n.left);
+            int64_t cost_right = descend_cost(n.right);
+
+            if (cost < cost_left && cost < cost_right)
+                break;
+            sibling = cost_left < cost_right ? n.left : n.right;
+        }
+
+        uint32_t old_parent = nodes[sibling].parent;
+        uint32_t new_parent = allocate_node();
+        nodes[new_parent].parent = old_parent;
+        nodes[new_parent].box = combine(leaf_box, nodes[sibling].box);
+        nodes[new_parent].height = nodes[sibling].height + 1;
+        nodes[new_parent].left = sibling;
+        nodes[new_parent].right = leaf;
+        nodes[sibling].parent = new_parent;
+        nodes[leaf].parent = new_parent;
+
+        if (old_parent == null_node) {
+            root = new_parent;
+        } else if (nodes[old_parent].left == sibling) {
+            nodes[old_parent].left = new_parent;
+        } else {
+            nodes[old_parent].right = new_parent;
+        }
+        refit(old_parent);
+    }
+
+    void aabb_tree::remove_leaf(uint32_t leaf) {
+        if (leaf == root) {
+            root = null_node;
+            return;
+        }
+
+        uint32_t parent = nodes[leaf].parent;
+        uint32_t grandparent = nodes[parent].parent;
+        uint32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+        // The parent is now redundant, so the sibling takes its place
+        if (grandparent == null_node) {
+            root = sibling;
+            nodes[sibling].parent = null_node;
+        } else {
+            if (nodes[grandparent].left == parent) {
+                nodes[grandparent].left = sibling;
+            } else {
+                nodes[grandparent].right = sibling;
+            }
+            nodes[sibling].parent = grandparent;
+        }
+        free_node(parent);
+        refit(grandparent);
+    }
+
+    // If the subtree rooted at `a` is imbalanced, rotate its taller child up into its place.
+    // Returns the index of the subtree's new root.
+    uint32_t aabb_tree::balance(uint32_t a) {
+        node& A = nodes[a];
+        if (A.leaf() || A.height < 2)
+            return a;
+
+        int32_t skew = nodes[A.right].height - nodes[A.left].height;
+        if (skew >= -1 && skew <= 1)
+            return a;
+
+        uint32_t b = skew > 0 ? A.right : A.left;   // the child being promoted
+        uint32_t c = skew > 0 ? A.left : A.right;   // the child staying under `a`
+        node& B = nodes[b];
+        uint32_t f = B.left;
+        uint32_t g = B.right;
+
+        // B takes A's place in the tree
+        B.left = a;
+        B.parent = A.parent;
+        A.parent = b;
+        if (B.parent == null_node) {
+            root = b;
+        } else if (nodes[B.parent].left == a) {
+            nodes[B.parent].left = b;
+        } else {
+            nodes[B.parent].right = b;
+        }
+
+        // B's taller child stays with it, the shorter one moves under A
+        uint32_t keep = nodes[f].height > nodes[g].height ? f : g;
+        uint32_t give = keep == f ? g : f;
+        B.right = keep;
+        if (skew > 0) {
+            A.right = give;
+        } else {
+            A.left = give;
+        }
+        nodes[give].parent = a;
+
+        A.box = combine(nodes[c].box, nodes[give].box);
+        A.height = 1 + std::max(nodes[c].height, nodes[give].height);
+        B.box = combine(A.box, nodes[keep].box);
+        B.height = 1 + std::max(A.height, nodes[keep].height);
+        return b;
+    }
+
+
+    bool aabb_tree::ray_hits(const aabb<int32_t>& box, vec2<float> origin, vec2<float> inv_dir, float max_t, float& t) {
+        float t_min = 0, t_max = max_t;
+        float o[2] = {origin.x, origin.y};
+        float inv[2] = {inv_dir.x, inv_dir.y};
+        float lo[2] = {float(box.min.x), float(box.min.y)};
+        float hi[2] = {float(box.max.x), float(box.max.y)};
+
+        for (int axis = 0; axis < 2; axis++) {
+            if (std::isinf(inv[axis])) {
+                if (o[axis] < lo[axis] || o[axis] > hi[axis])
+                    return false;
+                continue;
+            }
+            float t1 = (lo[axis] - o[axis]) * inv[axis];
+            float t2 = (hi[axis] - o[axis]) * inv[axis];
+            t_min = std::max(t_min, std::min(t1, t2));
+            t_max = std::min(t_max, std::max(t1, t2));
+            if (t_min > t_max)
+                return false;
+        }
+        t = t_min;
+        return true;
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef AABB_TREE_H
+#define AABB_TREE_H
+
+#include "broadphase.h"
+#include <common/coordinate_types.h>
+#include <common/snapshot_stream.h>
+
+#include <vector>
+#include <cstdint>
+
+namespace ecs {
+    // A dynamic bounding volume hierarchy over hitboxes, used for spatial queries.
+    // Leaves hold a fattened copy of their hitbox bounds, so small movements don't touch the tree at all,
+    // and the tree is rebalanced with AVL-style rotations as leaves are inserted and removed.
+    class aabb_tree {
+    public:
+        using proxy = uint32_t;
+        constexpr static proxy null_node = UINT32_MAX;
+        constexpr static int32_t fat_margin = 4;
+
+        proxy insert(const aabb<int32_t>& box, hitbox_ref data);
+        void remove(proxy p);
+        // Returns true if the leaf left its fattened bounds and had to be reinserted
+        bool move(proxy p, const aabb<int32_t>& box);
+
+        const hitbox_ref& data(proxy p) const { return nodes[p].data; }
+        const aabb<int32_t>& bounds(proxy p) const { return nodes[p].tight; }
+        int height() const { return root == null_node ? 0 : nodes[root].height; }
+
+        // Nodes are plain data, so the whole tree is saved and restored as one block
+        void save(snapshot_writer& w) const {
+            w.array(nodes);
+            w.value(root);
+            w.value(free_list);
+        }
+        void load(snapshot_reader& r) {
+            r.array(nodes);
+            r.value(root);
+            r.value(free_list);
+        }
+
+        // Calls `f(proxy)` for every leaf whose tight bounds overlap `box`
+        template <typename F> void query(const aabb<int32_t>& box, F&& f) const;
+        // Calls `f(proxy, t)` for every leaf hit by the ray `origin + dir * t`, for t in [0, max_t]
+        template <typename F> void raycast(vec2<float> origin, vec2<float> dir, float max_t, F&& f) const;
+    private:
+        struct node {
+            aabb<int32_t> box;   // fattened bounds for leaves, union of children otherwise
+            aabb<int32_t> tight; // leaves only
+            hitbox_ref data;
+            uint32_t parent = null_node; // next free node, while on the free list
+            uint32_t left = null_node;
+            uint32_t right = null_node;
+            int32_t height = 0;
+            bool leaf() const { return left == null_node; }
+        };
+
+        uint32_t allocate_node();
+        void free_node(uint32_t n);
+        void insert_leaf(uint32_t leaf);
+        void remove_leaf(uint32_t leaf);
+        uint32_t balance(uint32_t n);
+        void refit(uint32_t n);
+
+        static bool ray_hits(const aabb<int32_t>& box, vec2<float> origin, vec2<float> inv_dir, float max_t, float& t);
+
+        std::vector<node> nodes;
+        uint32_t root = null_node;
+        uint32_t free_list = null_node;
+        // traversal stack, reused between queries. Callbacks must not query the tree themselves
+        mutable std::vector<uint32_t> stack;
+    };
+
+    template <typename F>
+    void aabb_tree::query(const aabb<int32_t>& box, F&& f) const {
+        if (root == null_node)
+            return;
+        stack.clear();
+        stack.emplace_back(root);
+        while (!stack.empty()) {
+            uint32_t idx = stack.back();
+            const node& n = nodes[idx];
+            stack.pop_back();
+            if (!n.box.overlaps(box))
+                continue;
+
+            if (n.leaf()) {
+                if (n.tight.overlaps(box))
+                    f(proxy(idx));
+            } else {
+                stack.emplace_back(n.left);
+                stack.emplace_back(n.right);
+            }
+        }
+    }
+
+    template <typename F>
+    void aabb_tree::raycast(vec2<float> origin, vec2<float> dir, float max_t, F&& f) const {
+        if (root == null_node)
+            return;
+        // Division by zero is intended here, `ray_hits` treats an infinite inverse as a ray parallel to that axis
+        vec2<float> inv_dir{1.0f / dir.x, 1.0f / dir.y};
+        stack.clear();
+        stack.emplace_back(root);
+        while (!stack.empty()) {
+            uint32_t idx = stack.back();
+            const node& n = nodes[idx];
+            stack.pop_back();
+            float t = 0;
+            if (!ray_hits(n.box, origin, inv_dir, max_t, t))
+                continue;
+
+            if (n.leaf()) {
+                if (ray_hits(n.tight, origin, inv_dir, max_t, t))
+                    f(proxy(idx), t);
+            } else {
+                stack.emplace_back(n.left);
+                stack.emplace_back(n.right);
+            }
+        }
+    }
+}
+
+#endif //AABB_TREE_H
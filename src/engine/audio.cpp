@@ -192,13 +192,20 @@
             float gain = 1.0f / _active_tracks.size();
             for (auto it = _active_tracks.begin(); it != _active_tracks.end(); ++it) {
                 auto& stream = *it;
-                accumulator += float(stream.get_sample()) * _sink_volumes[(int)(stream.channel())];
-                if (stream.eos()) {
-                    _active_tracks.remove(it.index());
-                }
+                if (!stream.eos())
+                    accumulator += float(stream.get_sample()) * _sink_volumes[(int)(stream.channel())];
             }
             buffer[i] = sample(accumulator * gain) * _sink_volumes[(int)sink_channel::master];
         }
+
+        // Finished streams are only removed once mixing is done, as removing them mid-iteration skips streams
+        std::vector<size_t> finished;
+        for (auto it = _active_tracks.begin(); it != _active_tracks.end(); ++it) {
+            if ((*it).eos())
+                finished.emplace_back(it.index());
+        }
+        for (size_t id : finished)
+            _active_tracks.remove(id);
         SDL_QueueAudio(_device_id, buffer.data(), buffer.size() * sizeof(sample));
     }
 
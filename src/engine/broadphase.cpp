@@ -0,0 +1,308 @@
+#include "broadphase.h"
+#include <algorithm>
+
+namespace ecs {
+
+    aabb<uint16_t> hitbox_bounds(const collision::hitbox& hb) {
+        aabb<uint16_t> box{hb[0], hb[0]};
+        for (auto& vert : hb) {
+            box.min.x = std::min(box.min.x, vert.x);
+            box.min.y = std::min(box.min.y, vert.y);
+            box.max.x = std::max(box.max.x, vert.x);
+            box.max.y = std::max(box.max.y, vert.y);
+        }
+        return box;
+    }
+
+    void hitbox_store::clear() {
+        min_x.clear();
+        min_y.clear();
+        max_x.clear();
+        max_y.clear();
+        axis_aligned.clear();
+        refs.clear();
+        hitboxes.clear();
+        free_slots.clear();
+        owner.clear();
+        owned.clear();
+        num_owners = 0;
+    }
+
+    uint32_t hitbox_store::add(const collision::hitbox& hb, hitbox_ref ref) {
+        uint32_t slot = refs.size();
+        if (free_slots.empty()) {
+            min_x.emplace_back();
+            min_y.emplace_back();
+            max_x.emplace_back();
+            max_y.emplace_back();
+            axis_aligned.emplace_back();
+            refs.emplace_back();
+            hitboxes.emplace_back();
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        }
+        refs[slot] = ref;
+        set(slot, hb);
+        return slot;
+    }
+
+    bool hitbox_store::set(uint32_t slot, const collision::hitbox& hb) {
+        aabb<uint16_t> box = hitbox_bounds(hb);
+        // vertices are stored top-left, top-right, bottom-left, bottom-right
+        bool aligned = hb[0].y == hb[1].y && hb[2].y == hb[3].y && hb[0].x == hb[2].x && hb[1].x == hb[3].x;
+        bool same = hitboxes[slot] == hb && bounds(slot) == box && axis_aligned[slot] == aligned;
+        min_x[slot] = box.min.x;
+        min_y[slot] = box.min.y;
+        max_x[slot] = box.max.x;
+        max_y[slot] = box.max.y;
+        axis_aligned[slot] = aligned;
+        hitboxes[slot] = hb;
+        return !same;
+    }
+
+    void hitbox_store::remove(uint32_t slot) {
+        refs[slot] = hitbox_ref{no_entity, 0};
+        free_slots.emplace_back(slot);
+    }
+
+    void hitbox_store::release(uint32_t index, std::vector<uint32_t>& removed) {
+        for (uint32_t slot : owned[index]) {
+            remove(slot);
+            removed.emplace_back(slot);
+        }
+        owned[index].clear();
+        if (owner[index] != no_entity)
+            num_owners--;
+        owner[index] = no_entity;
+    }
+
+    void hitbox_store::sync(const collision& c, std::vector<uint32_t>& dirty, std::vector<uint32_t>& removed) {
+        uint32_t index = entity_index(c.entity_id);
+        if (index >= owner.size()) {
+            owner.resize(index + 1, no_entity);
+            owned.resize(index + 1);
+        }
+        // the index may have been handed to a new entity since its boxes were last seen
+        if (owner[index] != c.entity_id) {
+            release(index, removed);
+            owner[index] = c.entity_id;
+            num_owners++;
+        }
+
+        small_vector<uint32_t, 1>& slots = owned[index];
+        while (slots.size() > c.hitboxes.size()) {
+            remove(slots.back());
+            removed.emplace_back(slots.back());
+            slots.pop_back();
+        }
+        for (uint16_t i = 0; i < c.hitboxes.size(); i++) {
+            if (i == slots.size())
+                dirty.emplace_back(slots.emplace_back(add(c.hitboxes[i], hitbox_ref{c.entity_id, i})));
+            else if (set(slots[i], c.hitboxes[i]))
+                dirty.emplace_back(slots[i]);
+        }
+    }
+
+    void hitbox_store::remove_stale(const pool<collision>& col, std::vector<uint32_t>& removed) {
+        for (uint32_t index = 0; index < owner.size(); index++) {
+            if (owner[index] != no_entity && !(col.exists(index) && col[index].entity_id == owner[index]))
+                release(index, removed);
+        }
+    }
+
+    void uniform_grid::set_cell_size(uint16_t size) {
+        assertion(size > 0, "Grid cell size must be nonzero");
+        _cell_size = size;
+        clear();
+    }
+
+    void uniform_grid::clear() {
+        cells.clear();
+        ranges.clear();
+    }
+
+    void uniform_grid::unbucket(uint32_t box) {
+        cell_range& r = ranges[box];
+        if (!r.bucketed)
+            return;
+        for (uint32_t cx = r.min_x; cx <= r.max_x; cx++) {
+            for (uint32_t cy = r.min_y; cy <= r.max_y; cy++) {
+                auto it = cells.find(cx << 16 | cy);
+                std::vector<uint32_t>& cell = it->second;
+                *std::find(cell.begin(), cell.end(), box) = cell.back();
+                cell.pop_back();
+                if (cell.empty())
+                    cells.erase(it);
+            }
+        }
+        r.bucketed = false;
+    }
+
+    void uniform_grid::update(const hitbox_store& boxes, const std::vector<uint32_t>& dirty, const std::vector<uint32_t>& removed,
+                              const std::vector<uint8_t>& touched, std::vector<candidate_pair>& out) {
+        ranges.resize(boxes.size());
+        for (uint32_t box : removed)
+            unbucket(box);
+        for (uint32_t box : dirty) {
+            unbucket(box);
+            aabb<uint16_t> b = boxes.bounds(box);
+            cell_range& r = ranges[box];
+            r = cell_range{uint16_t(b.min.x / _cell_size), uint16_t(b.min.y / _cell_size),
+                           uint16_t(b.max.x / _cell_size), uint16_t(b.max.y / _cell_size), true};
+            for (uint32_t cx = r.min_x; cx <= r.max_x; cx++) {
+                for (uint32_t cy = r.min_y; cy <= r.max_y; cy++)
+                    cells[cx << 16 | cy].emplace_back(box);
+            }
+        }
+
+        for (uint32_t a : dirty) {
+            aabb<uint16_t> a_bounds = boxes.bounds(a);
+            const cell_range& r = ranges[a];
+            for (uint32_t cx = r.min_x; cx <= r.max_x; cx++) {
+                for (uint32_t cy = r.min_y; cy <= r.max_y; cy++) {
+                    uint32_t cell = cx << 16 | cy;
+                    for (uint32_t b : cells[cell]) {
+                        // pairs of two dirty boxes are found from both sides, so only the lower one reports them
+                        if (b == a || (touched[b] && b < a))
+                            continue;
+                        aabb<uint16_t> b_bounds = boxes.bounds(b);
+                        if (boxes.refs[a].entity_id == boxes.refs[b].entity_id || !a_bounds.overlaps(b_bounds))
+                            continue;
+
+                        // Two boxes may share several cells - only report them from the cell holding
+                        // the top-left corner of their intersection, so that each pair is tested once
+                        uint16_t x = std::max(a_bounds.min.x, b_bounds.min.x);
+                        uint16_t y = std::max(a_bounds.min.y, b_bounds.min.y);
+                        if (cell_key(x, y) == cell)
+                            out.emplace_back(candidate_pair{std::min(a, b), std::max(a, b)});
+                    }
+                }
+            }
+        }
+    }
+
+
+    void brute_force_pairs(const hitbox_store& boxes, const std::vector<uint32_t>& dirty, const std::vector<uint8_t>& touched,
+                           std::vector<candidate_pair>& out) {
+        for (uint32_t a : dirty) {
+            for (uint32_t b = 0; b < boxes.size(); b++) {
+                if (b == a || (touched[b] && b < a) || !boxes.live(b))
+                    continue;
+                if (boxes.refs[a].entity_id != boxes.refs[b].entity_id)
+                    out.emplace_back(candidate_pair{std::min(a, b), std::max(a, b)});
+            }
+        }
+    }
+
+
+    void sweep_and_prune::clear() {
+        boxes.clear();
+        for (auto& axis : axes)
+            axis.clear();
+        pairs.clear();
+        present = 0;
+        added = 0;
+    }
+
+    void sweep_and_prune::add_pair(uint32_t a, uint32_t b) {
+        if (boxes[a].entity_id != boxes[b].entity_id && boxes[a].bounds.overlaps(boxes[b].bounds))
+            pairs.emplace(pair_key(a, b));
+    }
+
+    // Insertion sort, starting from last tick's order. Two boxes can only begin or stop overlapping
+    // on this axis when one's min endpoint crosses the other's max, so pairs are updated right as those swaps happen.
+    void sweep_and_prune::sort_axis(std::vector<endpoint>& axis) {
+        for (size_t i = 1; i < axis.size(); i++) {
+            endpoint moving = axis[i];
+            size_t j = i;
+            for (; j > 0 && axis[j - 1].key > moving.key; j--) {
+                const endpoint& passed = axis[j - 1];
+                bool moving_max = moving.key & 1;
+                bool passed_max = passed.key & 1;
+                if (!moving_max && passed_max) {
+                    add_pair(moving.box, passed.box);
+                } else if (moving_max && !passed_max) {
+                    pairs.erase(pair_key(moving.box, passed.box));
+                }
+                axis[j] = passed;
+                _swaps++;
+            }
+            axis[j] = moving;
+        }
+    }
+
+    // Sorts both axes from scratch and finds pairs with a single sweep over the x axis.
+    // Used when many boxes are added at once, where insertion sort would degrade to quadratic time.
+    void sweep_and_prune::rebuild() {
+        auto by_key = [](const endpoint& lhs, const endpoint& rhs) { return lhs.key < rhs.key; };
+        for (auto& axis : axes)
+            std::sort(axis.begin(), axis.end(), by_key);
+
+        pairs.clear();
+        std::vector<uint32_t> active;
+        for (auto& e : axes[0]) {
+            if (e.key & 1) {
+                active.erase(std::find(active.begin(), active.end(), e.box));
+                continue;
+            }
+            for (uint32_t other : active)
+                add_pair(e.box, other);
+            active.emplace_back(e.box);
+        }
+    }
+
+    void sweep_and_prune::update(const hitbox_store& store, const std::vector<uint32_t>& dirty, const std::vector<uint32_t>& removed,
+                                 std::vector<candidate_pair>& out) {
+        boxes.resize(store.size());
+        if (!removed.empty()) {
+            for (uint32_t slot : removed) {
+                if (boxes[slot].present)
+                    present--;
+                boxes[slot].present = false;
+            }
+            auto gone = [&](const endpoint& e) { return !boxes[e.box].present; };
+            for (auto& axis : axes)
+                axis.erase(std::remove_if(axis.begin(), axis.end(), gone), axis.end());
+            std::erase_if(pairs, [&](uint64_t key) { return !boxes[key >> 32].present || !boxes[uint32_t(key)].present; });
+        }
+
+        for (uint32_t slot : dirty) {
+            box& b = boxes[slot];
+            if (!b.present) {
+                // New endpoints start at the far end of each axis, disjoint from everything.
+                // Sorting them into place then reports their overlaps like any other movement would.
+                for (auto& axis : axes) {
+                    axis.emplace_back(endpoint{UINT32_MAX - 1, slot});
+                    axis.emplace_back(endpoint{UINT32_MAX, slot});
+                }
+                b.present = true;
+                present++;
+                added++;
+            }
+            b.bounds = store.bounds(slot);
+            b.entity_id = store.refs[slot].entity_id;
+        }
+
+        _swaps = 0;
+        for (int dim = 0; dim < 2; dim++) {
+            for (auto& e : axes[dim]) {
+                const aabb<uint16_t>& b = boxes[e.box].bounds;
+                uint16_t coord = (e.key & 1) ? (dim ? b.max.y : b.max.x) : (dim ? b.min.y : b.min.x);
+                e.key = uint32_t(coord) << 1 | (e.key & 1);
+            }
+        }
+        if (added > present / 4) {
+            rebuild();
+        } else {
+            for (auto& axis : axes)
+                sort_axis(axis);
+        }
+        added = 0;
+
+        size_t first = out.size();
+        for (uint64_t key : pairs)
+            out.emplace_back(candidate_pair{uint32_t(key >> 32), uint32_t(key)});
+        std::sort(out.begin() + first, out.end());
+    }
+}
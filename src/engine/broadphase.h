@@ -0,0 +1,149 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include "ecs.h"
+#include <array>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace ecs {
+    // Identifies a single hitbox by its owning entity, and its index into `collision::hitboxes`
+    struct hitbox_ref {
+        entity entity_id;
+        uint16_t index;
+    };
+
+    // A pair of hitboxes that may overlap. `a` and `b` are `hitbox_store` slots
+    struct candidate_pair {
+        uint32_t a, b;
+        bool operator<(const candidate_pair& rhs) const { return a != rhs.a ? a < rhs.a : b < rhs.b; }
+    };
+
+    aabb<uint16_t> hitbox_bounds(const collision::hitbox& hb);
+
+    // Every hitbox in the collision pool, kept between ticks in stable slots so only the ones that changed need
+    // updating. Bounds are kept one array per coordinate so the narrow phase can test several candidates at once.
+    // Freed slots stay in the arrays until they're reused, with `no_entity` as their owner.
+    struct hitbox_store {
+        constexpr static entity no_entity = ~entity(0);
+
+        std::vector<int32_t> min_x, min_y, max_x, max_y;
+        std::vector<uint8_t> axis_aligned;
+        std::vector<hitbox_ref> refs;
+        std::vector<collision::hitbox> hitboxes;
+
+        size_t size() const { return refs.size(); } // slots, free ones included
+        size_t count() const { return refs.size() - free_slots.size(); }
+        bool live(uint32_t slot) const { return refs[slot].entity_id != no_entity; }
+        void clear();
+        uint32_t add(const collision::hitbox& hb, hitbox_ref ref);
+        // returns false if the slot already held exactly `hb`
+        bool set(uint32_t slot, const collision::hitbox& hb);
+        void remove(uint32_t slot);
+        aabb<uint16_t> bounds(uint32_t i) const {
+            return aabb<uint16_t>{vec2<uint16_t>{uint16_t(min_x[i]), uint16_t(min_y[i])},
+                vec2<uint16_t>{uint16_t(max_x[i]), uint16_t(max_y[i])}};
+        }
+
+        // Brings the slots kept for `c`'s entity in line with its hitboxes. Slots that were added or now hold a
+        // different box are appended to `dirty`, and freed ones to `removed`.
+        void sync(const collision& c, std::vector<uint32_t>& dirty, std::vector<uint32_t>& removed);
+        // Frees the slots of every entity which no longer has a collision component, appending them to `removed`
+        void remove_stale(const pool<collision>& col, std::vector<uint32_t>& removed);
+        // entities whose boxes are kept, which is more than the collision pool holds once any were removed
+        size_t owners() const { return num_owners; }
+    private:
+        void release(uint32_t index, std::vector<uint32_t>& removed);
+
+        std::vector<uint32_t> free_slots;
+        std::vector<entity> owner;                    // by entity index, the entity whose boxes are kept
+        std::vector<small_vector<uint32_t, 1>> owned; // by entity index, slots in hitbox order
+        size_t num_owners = 0;
+    };
+
+    struct collision_stats {
+        size_t hitboxes = 0;
+        size_t candidate_pairs = 0;
+        size_t overlaps = 0;
+        size_t sort_swaps = 0; // sweep and prune only
+        size_t cache_hits = 0; // candidate pairs whose narrow phase result was reused
+        size_t elapsed_us = 0;
+    };
+
+    enum class broadphase_mode { brute_force, grid, sweep_and_prune };
+
+    // Buckets hitbox bounds into square cells of `cell_size` pixels, and reports pairs which share a cell.
+    // A box spanning several cells is bucketed into each of them, but every pair is reported exactly once.
+    // Buckets are kept between ticks, so only boxes that changed are moved between them.
+    class uniform_grid {
+    public:
+        uniform_grid(uint16_t cell_size = 64) { set_cell_size(cell_size); }
+        void set_cell_size(uint16_t size);
+        uint16_t cell_size() const { return _cell_size; }
+        void clear();
+
+        // Takes `removed` boxes out of their cells and re-buckets `dirty` ones, then appends every pair involving a
+        // dirty box to `out`, with `a < b`. `touched[i]` must be nonzero for each box in either list.
+        void update(const hitbox_store& boxes, const std::vector<uint32_t>& dirty, const std::vector<uint32_t>& removed,
+                    const std::vector<uint8_t>& touched, std::vector<candidate_pair>& out);
+    private:
+        struct cell_range {
+            uint16_t min_x, min_y, max_x, max_y;
+            bool bucketed = false;
+        };
+        uint32_t cell_key(uint16_t x, uint16_t y) const { return uint32_t(x / _cell_size) << 16 | (y / _cell_size); }
+        void unbucket(uint32_t box);
+
+        std::unordered_map<uint32_t, std::vector<uint32_t>> cells; // cell key -> boxes overlapping it
+        std::vector<cell_range> ranges; // by box, the cells it's bucketed in
+        uint16_t _cell_size = 64;
+    };
+
+    // Appends every pair of a `dirty` box with a box of a different entity to `out`, with `a < b`.
+    // `touched[i]` must be nonzero for each dirty box.
+    void brute_force_pairs(const hitbox_store& boxes, const std::vector<uint32_t>& dirty, const std::vector<uint8_t>& touched,
+                           std::vector<candidate_pair>& out);
+
+    // Keeps the endpoints of every hitbox sorted along both axes between ticks, and tracks overlapping pairs
+    // as endpoints swap places. Bodies rarely move far in a single tick, so the endpoint lists stay nearly
+    // sorted and insertion sort brings them back in order with only a handful of swaps.
+    // Only boxes that changed can swap, but refreshing the keys and the sort's pass still walk every endpoint,
+    // and the whole pair list is written out again each time, so unlike the other broad phases, this one stays
+    // linear in the number of boxes even when few of them moved.
+    class sweep_and_prune {
+    public:
+        void clear();
+        // Takes out `removed` boxes and adds or moves `dirty` ones, then appends every overlapping pair to `out`,
+        // in sorted order so that pairs sharing a box are adjacent for the narrow phase
+        void update(const hitbox_store& boxes, const std::vector<uint32_t>& dirty, const std::vector<uint32_t>& removed,
+                    std::vector<candidate_pair>& out);
+        // number of endpoint swaps made while sorting, during the last call to `update`
+        size_t swaps() const { return _swaps; }
+    private:
+        struct endpoint {
+            uint32_t key; // (coordinate << 1 | is_max), so that mins sort before maxes of equal value
+            uint32_t box;
+        };
+        // by hitbox_store slot
+        struct box {
+            aabb<uint16_t> bounds;
+            entity entity_id;
+            bool present = false;
+        };
+
+        void sort_axis(std::vector<endpoint>& axis);
+        void rebuild();
+        void add_pair(uint32_t a, uint32_t b);
+        static uint64_t pair_key(uint32_t a, uint32_t b) { return a < b ? uint64_t(a) << 32 | b : uint64_t(b) << 32 | a; }
+
+        std::vector<box> boxes;
+        std::array<std::vector<endpoint>, 2> axes;
+        std::unordered_set<uint64_t> pairs;
+        size_t present = 0;
+        size_t added = 0; // boxes added since the last sort
+        size_t _swaps = 0;
+    };
+}
+
+#endif //BROADPHASE_H
@@ -0,0 +1,71 @@
+#include "commands.h"
+#include <algorithm>
+
+namespace ecs {
+
+    static void add_component(entity_manager& em, entity e, component_id c) {
+        #define GENERATE_ADD_CASES(T) case T ## _id: if (!em.exists<T>(e)) em.add<T>(e); break;
+        switch (c) {
+            ALL_COMPONENTS(GENERATE_ADD_CASES)
+            default: break;
+        }
+    }
+
+    static void remove_component(entity_manager& em, entity e, component_id c, const command_queue::release_hook& release) {
+        #define GENERATE_REMOVE_CASES(T) case T ## _id: \
+            if (em.exists<T>(e)) { release(e, c); em.remove<T>(e); } \
+            break;
+        switch (c) {
+            ALL_COMPONENTS(GENERATE_REMOVE_CASES)
+            default: break;
+        }
+    }
+
+    static void destroy_entity(entity_manager& em, entity e, const command_queue::release_hook& release) {
+        if (!em.alive(e))
+            return;
+        #define GENERATE_RELEASE_CALLS(T) if (em.exists<T>(e)) release(e, T ## _id);
+        ALL_COMPONENTS(GENERATE_RELEASE_CALLS)
+        em.remove_entity(e);
+    }
+
+    void command_queue::flush(entity_manager& em, const release_hook& release) {
+        merged.clear();
+        for (auto& buf : buffers) {
+            created.clear();
+            for (const command& cmd : buf.commands) {
+                if (cmd.kind == command::type::create)
+                    created.emplace_back(em.add_entity());
+            }
+            for (command cmd : buf.commands) {
+                if (cmd.kind == command::type::create)
+                    continue;
+                if (is_placeholder(cmd.target))
+                    cmd.target = created[entity_index(cmd.target)];
+                merged.emplace_back(cmd);
+            }
+            buf.commands.clear();
+            buf.num_created = 0;
+        }
+
+        // destroys sort after every pool, since their component is num_components
+        std::stable_sort(merged.begin(), merged.end(), [](const command& a, const command& b) { return a.component < b.component; });
+        for (const command& cmd : merged) {
+            switch (cmd.kind) {
+                case command::type::add:
+                    if (em.alive(cmd.target))
+                        add_component(em, cmd.target, cmd.component);
+                    break;
+                case command::type::remove:
+                    if (em.alive(cmd.target))
+                        remove_component(em, cmd.target, cmd.component, release);
+                    break;
+                case command::type::destroy:
+                    destroy_entity(em, cmd.target, release);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
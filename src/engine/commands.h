@@ -0,0 +1,64 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include "ecs.h"
+#include <common/thread_pool.h>
+
+#include <functional>
+#include <vector>
+
+namespace ecs {
+    // Entities created through a command buffer don't exist until it's flushed, so they're handed out as
+    // placeholders with a generation no living entity can have. A placeholder only means something to the
+    // buffer that made it.
+    constexpr static uint32_t placeholder_generation = entity_generation_mask;
+    constexpr bool is_placeholder(entity e) { return entity_generation(e) == placeholder_generation; }
+
+    struct command {
+        enum class type : uint8_t { create, add, remove, destroy } kind;
+        component_id component; // for add and remove
+        entity target;
+    };
+
+    // Records structural changes without touching any pool, so systems can spawn and despawn while iterating
+    class command_buffer {
+    public:
+        entity create() {
+            entity e = make_entity(num_created++, placeholder_generation);
+            commands.emplace_back(command{command::type::create, num_components, e});
+            return e;
+        }
+        void destroy(entity e) { commands.emplace_back(command{command::type::destroy, num_components, e}); }
+        template <typename T> void add(entity e) { commands.emplace_back(command{command::type::add, component_index<T>, e}); }
+        template <typename T> void remove(entity e) { commands.emplace_back(command{command::type::remove, component_index<T>, e}); }
+
+        bool empty() const { return commands.empty(); }
+    private:
+        std::vector<command> commands;
+        uint32_t num_created = 0;
+        friend class command_queue;
+    };
+
+    // One command buffer per worker thread, plus one for every thread outside the pool, merged at each flush
+    class command_queue {
+    public:
+        // Called before a component is taken off a living entity, including when the entity is destroyed
+        using release_hook = std::function<void(entity, component_id)>;
+
+        command_queue(thread_pool& workers) : workers(workers), buffers(workers.size() + 1) {}
+        // The calling thread's buffer. Threads outside the pool share a buffer, so only one of them should record at a time.
+        command_buffer& local() { return buffers[workers.current_worker()]; }
+
+        // Applies every recorded command and empties the buffers. Creates go first so placeholders can be resolved,
+        // then adds and removes grouped by pool, in the order they were recorded, then destroys.
+        // Commands for entities that are already gone are dropped.
+        void flush(entity_manager& em, const release_hook& release);
+    private:
+        thread_pool& workers;
+        std::vector<command_buffer> buffers;
+        std::vector<command> merged;
+        std::vector<entity> created;
+    };
+}
+
+#endif //COMMANDS_H
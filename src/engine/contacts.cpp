@@ -0,0 +1,132 @@
+#include "contacts.h"
+#include <algorithm>
+
+namespace ecs {
+
+    contact_cache::key contact_cache::make_key(const hitbox_store& boxes, uint32_t& a, uint32_t& b) const {
+        hitbox_ref ra = boxes.refs[a], rb = boxes.refs[b];
+        if (rb.entity_id < ra.entity_id || (rb.entity_id == ra.entity_id && rb.index < ra.index)) {
+            std::swap(ra, rb);
+            std::swap(a, b);
+        }
+        return key{ra, rb};
+    }
+
+    void contact_cache::update(const hitbox_store& boxes, const std::vector<candidate_pair>& pairs, std::vector<candidate_pair>& contacts,
+                               std::vector<contact_event>& events, thread_pool& workers) {
+        tick++;
+        _hits = 0;
+        untested.clear();
+        tested.clear();
+
+        for (const candidate_pair& p : pairs) {
+            uint32_t a = p.a, b = p.b;
+            key k = make_key(boxes, a, b);
+            entry* found = entries.find(k);
+            if (!found || found->hitbox_a != boxes.hitboxes[a] || found->hitbox_b != boxes.hitboxes[b]) {
+                untested.emplace_back(p);
+                continue;
+            }
+            entry& e = *found;
+            e.was_touching = e.touching;
+            e.tick = tick;
+            if (e.touching)
+                contacts.emplace_back(p);
+            _hits++;
+        }
+
+        // Narrow phase whatever couldn't be reused; its contacts come back in the same order as `untested`
+        narrow_phase(boxes, untested, tested, workers);
+        size_t next_contact = 0;
+        for (const candidate_pair& p : untested) {
+            bool touching = next_contact < tested.size() && tested[next_contact].a == p.a && tested[next_contact].b == p.b;
+            if (touching) {
+                next_contact++;
+                contacts.emplace_back(p);
+            }
+            uint32_t a = p.a, b = p.b;
+            key k = make_key(boxes, a, b);
+            auto [found, inserted] = entries.try_emplace(k, entry{boxes.hitboxes[a], boxes.hitboxes[b], tick, false, false});
+            entry& e = *found;
+            e.was_touching = inserted ? false : e.touching;
+            e.hitbox_a = boxes.hitboxes[a];
+            e.hitbox_b = boxes.hitboxes[b];
+            e.tick = tick;
+            e.touching = touching;
+        }
+
+        events.clear();
+        entries.erase_if([&](const key& k, entry& e) {
+            bool candidate = e.tick == tick;
+            bool now = candidate && e.touching;
+            bool before = candidate ? e.was_touching : e.touching;
+            if (now || before) {
+                contact_event::type kind = now && before ? contact_event::type::stay : now ? contact_event::type::begin : contact_event::type::end;
+                events.emplace_back(contact_event{k.a.entity_id, k.b.entity_id, k.a.index, k.b.index, kind});
+            }
+            return !candidate;
+        });
+        // map order depends on the order pairs were first seen in, so give readers something stable
+        std::sort(events.begin(), events.end(), [](const contact_event& l, const contact_event& r) {
+            if (l.a != r.a) return l.a < r.a;
+            if (l.b != r.b) return l.b < r.b;
+            if (l.hitbox_a != r.hitbox_a) return l.hitbox_a < r.hitbox_a;
+            return l.hitbox_b < r.hitbox_b;
+        });
+    }
+
+    void contact_graph::clear() {
+        adjacency.clear();
+        _began.clear();
+    }
+
+    void contact_graph::add_link(entity from, entity to, int32_t delta) {
+        uint32_t index = entity_index(from);
+        if (index >= adjacency.size())
+            adjacency.resize(index + 1);
+        small_vector<link, 2>& links = adjacency[index];
+        for (link& l : links) {
+            if (l.other != to)
+                continue;
+            l.pairs += delta;
+            if (l.pairs == 0) {
+                l = links.back();
+                links.pop_back();
+            }
+            return;
+        }
+        if (delta > 0)
+            links.emplace_back(link{to, uint32_t(delta)});
+    }
+
+    void contact_graph::connect(entity a, entity b) {
+        add_link(a, b, 1);
+        add_link(b, a, 1);
+    }
+    void contact_graph::disconnect(entity a, entity b) {
+        add_link(a, b, -1);
+        add_link(b, a, -1);
+    }
+
+    void contact_graph::apply(const std::vector<contact_event>& events) {
+        _began.clear();
+        for (const contact_event& ev : events) {
+            if (ev.kind == contact_event::type::begin) {
+                connect(ev.a, ev.b);
+                _began.emplace_back(ev.a);
+                _began.emplace_back(ev.b);
+            } else if (ev.kind == contact_event::type::end) {
+                disconnect(ev.a, ev.b);
+            }
+        }
+    }
+
+    void contact_cache::save(snapshot_writer& w) const {
+        w.value(tick);
+        entries.save(w);
+    }
+    void contact_cache::load(snapshot_reader& r) {
+        r.value(tick);
+        entries.load(r);
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef CONTACTS_H
+#define CONTACTS_H
+
+#include "broadphase.h"
+#include "narrowphase.h"
+#include <common/flat_hash_map.h>
+#include <common/snapshot_stream.h>
+#include <vector>
+
+namespace ecs {
+    struct contact_event {
+        enum class type : uint8_t { begin, stay, end };
+        entity a, b;
+        uint16_t hitbox_a, hitbox_b;
+        type kind;
+    };
+
+    // Remembers every candidate pair between ticks, keyed by the two hitboxes, along with whether they touched.
+    // A pair whose two hitboxes have exactly the same vertices as last tick reuses that result instead of being
+    // narrow-phased again. Bounds alone aren't enough, since a box rotated in place can keep them.
+    class contact_cache {
+    public:
+        // Narrow-phases `pairs`, writing the touching ones to `contacts`, and what changed since last tick to `events`.
+        // Pairs which touched last tick but aren't candidates any more end, and are forgotten.
+        void update(const hitbox_store& boxes, const std::vector<candidate_pair>& pairs, std::vector<candidate_pair>& contacts,
+                    std::vector<contact_event>& events, thread_pool& workers);
+
+        size_t size() const { return entries.size(); }
+        size_t hits() const { return _hits; } // pairs reused in the last update
+        // calls f(hitbox_ref, hitbox_ref) for every pair that touched as of the last update
+        template <typename F> void for_each_touching(F&& f) const {
+            entries.for_each([&](const key& k, const entry& e) {
+                if (e.touching)
+                    f(k.a, k.b);
+            });
+        }
+
+        void save(snapshot_writer& w) const;
+        void load(snapshot_reader& r);
+    private:
+        // Ordered so the same two hitboxes always make the same key, regardless of which was found first
+        struct key {
+            hitbox_ref a, b;
+            bool operator==(const key& rhs) const {
+                return a.entity_id == rhs.a.entity_id && a.index == rhs.a.index && b.entity_id == rhs.b.entity_id && b.index == rhs.b.index;
+            }
+        };
+        struct key_hash {
+            size_t operator()(const key& k) const {
+                uint64_t a = uint64_t(k.a.entity_id) << 16 | k.a.index, b = uint64_t(k.b.entity_id) << 16 | k.b.index;
+                return std::hash<uint64_t>()(a * 0x9e3779b97f4a7c15ull ^ b);
+            }
+        };
+        struct entry {
+            collision::hitbox hitbox_a, hitbox_b; // as they were when last narrow-phased
+            uint32_t tick;     // last update this pair was a candidate in
+            bool touching;     // as of `tick`
+            bool was_touching; // as of the update before
+        };
+        // swaps `a` and `b` into key order
+        key make_key(const hitbox_store& boxes, uint32_t& a, uint32_t& b) const;
+
+        flat_hash_map<key, entry, key_hash> entries; // flat, so a snapshot restores it in one copy
+        std::vector<candidate_pair> untested;
+        std::vector<candidate_pair> tested;
+        uint32_t tick = 0;
+        size_t _hits = 0;
+    };
+
+    // Which entities touch which, kept up to date from each tick's contact events rather than rebuilt
+    class contact_graph {
+    public:
+        struct link {
+            entity other;
+            uint32_t pairs; // touching hitbox pairs between the two
+        };
+        void clear();
+        void connect(entity a, entity b);
+        void disconnect(entity a, entity b);
+        // Connects and disconnects along begin and end events, and remembers who took part in a begin
+        void apply(const std::vector<contact_event>& events);
+
+        const small_vector<link, 2>& links(entity e) const {
+            return entity_index(e) < adjacency.size() ? adjacency[entity_index(e)] : none;
+        }
+        // both sides of every contact that began in the last `apply`
+        const std::vector<entity>& began() const { return _began; }
+    private:
+        void add_link(entity from, entity to, int32_t delta);
+
+        std::vector<small_vector<link, 2>> adjacency; // by entity index
+        std::vector<entity> _began;
+        small_vector<link, 2> none;
+    };
+
+    // State `run_collision` keeps between ticks. Hitboxes, broad phase buckets and candidate pairs are all updated
+    // from just the collision components that changed since `seen_tick`, so sleeping bodies cost nothing to skip.
+    struct collision_world {
+        broadphase_mode mode = broadphase_mode::grid;
+        uniform_grid grid;
+        sweep_and_prune sap;
+        hitbox_store boxes;
+        std::vector<candidate_pair> pairs; // sorted
+        std::vector<candidate_pair> contacts;
+        contact_cache cache;
+        std::vector<contact_event> events; // from the last tick only
+        contact_graph graph;
+        collision_stats stats;
+        uint32_t seen_tick = 0;
+        // set to drop everything and start over from the whole pool, after the mode or the pool itself is replaced
+        bool rebuild = true;
+
+        // scratch, by hitbox_store slot
+        std::vector<uint32_t> dirty, removed;
+        std::vector<uint8_t> touched;
+        std::vector<candidate_pair> found;
+    };
+}
+
+#endif //CONTACTS_H
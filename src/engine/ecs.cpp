@@ -1,82 +1,110 @@
 #include "ecs.h"
-#include "engine.h"
+#include "contacts.h"
+#include "physics.h"
+#include <common/stopwatch.h>
+#include <common/thread_pool.h>
 #include <algorithm>
 
 namespace ecs {
 
-	void run_physics(engine* e, pool<display>& dpy, pool<physics>& phys) {
-		for (auto& p : phys) {
-			p.velocity.x += p.accel.x;
-			p.velocity.y += p.accel.y;
-
-		    p.velocity.x = std::clamp(p.velocity.x, -p.velocity_cap.x, p.velocity_cap.x);
-		    p.velocity.y = std::clamp(p.velocity.y, -p.velocity_cap.y, p.velocity_cap.y);
-
-			for (auto& s : dpy[p.entity_id].sprites) {
-				moveby(e, p.entity_id, s, p.velocity.x, p.velocity.y);
-			}
+	// Bodies per job, a multiple of the 8-wide kernel and of a cache line's worth of every column
+	constexpr static size_t bodies_per_chunk = 1024;
+
+	void run_physics(entity_manager& em, const collision_world& world, thread_pool& workers) {
+		update_sleep(em, world);
+
+		// Only awake bodies are integrated, and they're all at the front of the pool
+		pool<physics>& bodies = em.get_pool<physics>();
+		// chunked by the narrowest column, so every column's chunks fall on whole cache lines
+		workers.parallel_for<uint16_t>(0, bodies.num_awake(), bodies_per_chunk, [&](size_t lo, size_t hi) {
+			integrate_bodies(bodies.bodies, lo, hi);
+			update_rest(bodies.bodies, lo, hi);
+		});
+
+		// Moving sprites and hitboxes goes through the renderer and the spatial tree, which aren't safe to share,
+		// so every body that moved is listed for the systems that own them
+		bodies.moved.clear();
+		const body_columns& b = bodies.bodies;
+		for (size_t i = 0; i < bodies.num_awake(); i++) {
+			if (b.vel_x[i] == 0 && b.vel_y[i] == 0 && b.step_x[i] == 0 && b.step_y[i] == 0)
+				continue;
+			bodies.moved.emplace_back(body_move{bodies.at(i).entity_id, b.step_x[i], b.step_y[i], b.vel_x[i], b.vel_y[i]});
 		}
 	}
 
-	void get_normals(vec2<int>* normals, collision::hitbox& hb) {
-		for (size_t i = 0; i < 4; i++) {
-			vec2<int> edge = hb[(i + 1) % 4].to<int>() - hb[i].to<int>();
-			normals[i] = vec2<int>(-edge.y, edge.x);
+	void run_collision(entity_manager& em, collision_world& world, thread_pool& workers) {
+		stopwatch timer;
+		timer.start();
+		pool<collision>& col = em.get_pool<collision>();
+
+		uint32_t now = em.checkpoint();
+		world.dirty.clear();
+		world.removed.clear();
+		if (world.rebuild) {
+			world.boxes.clear();
+			world.grid.clear();
+			world.sap.clear();
+			world.pairs.clear();
+			// the cache may have been loaded from a snapshot, so the graph starts over from what it says touched
+			world.graph.clear();
+			world.cache.for_each_touching([&](hitbox_ref a, hitbox_ref b) { world.graph.connect(a.entity_id, b.entity_id); });
+			for (auto& c : col)
+				world.boxes.sync(c, world.dirty, world.removed);
+			world.rebuild = false;
+		} else {
+			for (auto& c : em.changed<collision>(world.seen_tick))
+				world.boxes.sync(c, world.dirty, world.removed);
+			// removed components leave no mark, but every one still in the pool was just synced, so any extra
+			// owners the store has are gone
+			if (world.boxes.owners() > col.size())
+				world.boxes.remove_stale(col, world.removed);
 		}
-	}
-
-	// Project the vertices of the shape onto each normal, to determine overlaps and gaps
-	void project_shape(vec2<int> normal, collision::hitbox& hb, float& min, float& max) {
-	    for (int i = 0; i < 4; i++) {
-	        float projection = (hb[i].x * normal.x) + (hb[i].y * normal.y);
-	        min = std::min(min, projection);
-    	    max = std::max(max, projection);
-	    }
-	}
-
-	bool hitbox_overlap(collision::hitbox& hb1, collision::hitbox& hb2) {
-		vec2<int> normals[8];
-		get_normals(normals, hb1);
-		get_normals(normals + 4, hb2);
-
-		for (int i = 0; i < 8; i++) {
-        	float a_min = 65535, a_max = 0, b_min = 65535, b_max = 0;
-
-	        project_shape(normals[i], hb1, a_min, a_max);
-	        project_shape(normals[i], hb2, b_min, b_max);
+		world.seen_tick = now;
+
+		// Pairs only depend on hitboxes, so last tick's still stand unless one of their boxes changed
+		world.stats.sort_swaps = 0;
+		if (!world.dirty.empty() || !world.removed.empty()) {
+			world.touched.resize(world.boxes.size());
+			for (uint32_t box : world.dirty)
+				world.touched[box] = 1;
+			for (uint32_t box : world.removed)
+				world.touched[box] = 1;
+
+			if (world.mode == broadphase_mode::sweep_and_prune) {
+				world.pairs.clear();
+				world.sap.update(world.boxes, world.dirty, world.removed, world.pairs);
+				world.stats.sort_swaps = world.sap.swaps();
+			} else {
+				std::erase_if(world.pairs, [&](const candidate_pair& p) { return world.touched[p.a] || world.touched[p.b]; });
+				world.found.clear();
+				if (world.mode == broadphase_mode::grid)
+					world.grid.update(world.boxes, world.dirty, world.removed, world.touched, world.found);
+				else
+					brute_force_pairs(world.boxes, world.dirty, world.touched, world.found);
+				std::sort(world.found.begin(), world.found.end());
+				size_t kept = world.pairs.size();
+				world.pairs.insert(world.pairs.end(), world.found.begin(), world.found.end());
+				std::inplace_merge(world.pairs.begin(), world.pairs.begin() + kept, world.pairs.end());
+			}
 
-	        bool a = (a_min < b_max) && (a_min > b_min);
-	        bool b = (b_min < a_max) && (b_min > a_min);
-	        if ((a || b) == false) {
-	            return false;
-	        }
+			for (uint32_t box : world.dirty)
+				world.touched[box] = 0;
+			for (uint32_t box : world.removed)
+				world.touched[box] = 0;
 		}
-		return true;
+		world.contacts.clear();
+		world.cache.update(world.boxes, world.pairs, world.contacts, world.events, workers);
+		world.graph.apply(world.events);
+
+		world.stats.hitboxes = world.boxes.count();
+		world.stats.candidate_pairs = world.pairs.size();
+		world.stats.overlaps = world.contacts.size();
+		world.stats.cache_hits = world.cache.hits();
+		world.stats.elapsed_us = timer.elapsed<stopwatch::microseconds>();
 	}
 
-
-	void run_collision(pool<collision>& col) {
-		
-		for (auto it1 = col.begin(); it1 != col.end(); ++it1) {
-
-			auto it2 = it1;
-			++it2;
-			for (; it2 != col.end(); ++it2) {
-
-				for (auto& hb1 : (*it1).hitboxes) {
-					for (auto& hb2 : (*it2).hitboxes) {
-						if (hitbox_overlap(hb1, hb2)) {
-							printf("Objects collided!\n");
-						}
-					}
-				}
-			}
-		}
- 	}
-
 	// more higher-order macros
-    #define GENERATE_REMOVE_CALLS(T) POOL_NAME(T).remove(e);
-    #define GENERATE_RESIZE_CALLS(T) POOL_NAME(T).set_capacity(new_size);
+    #define GENERATE_REMOVE_CALLS(T) POOL_NAME(T).remove(index);
 	#define GEN_ADD_INST(T) template T& entity_manager::add<T>(entity e);
 	#define GEN_GET_INST(T) template T& entity_manager::get<T>(entity e);
 	#define GEN_REMOVE_INST(T) template void entity_manager::remove<T>(entity e);
@@ -90,39 +118,96 @@ namespace ecs {
 	ALL_COMPONENTS(GEN_GETPOOL_INST)
 
     template <typename T> T& entity_manager::add(entity e) {
-        assertion(entities.get(e), "Cannot modify nonexistent entity");
-        T& c = get_pool<T>().insert(e, T());
+        assertion(alive(e), "Cannot modify nonexistent entity");
+        T& c = get_pool<T>().insert(entity_index(e), T());
         c.entity_id = e;
+        mark_changed<T>(e);
         return c;
     }
     template <typename T> T& entity_manager::get(entity e) {
-        assertion(entities.get(e), "Cannot modify nonexistent entity");
-        return get_pool<T>()[e];
+        assertion(alive(e), "Cannot modify nonexistent entity");
+        mark_changed<T>(e);
+        return get_pool<T>()[entity_index(e)];
     }
     template <typename T> void entity_manager::remove(entity e) {
-        assertion(entities.get(e), "Cannot modify nonexistent entity");
-        get_pool<T>().remove(e);
+        assertion(alive(e), "Cannot modify nonexistent entity");
+        get_pool<T>().remove(entity_index(e));
     }
     template <typename T> bool entity_manager::exists(entity e) {
-        return get_pool<T>().exists(e);
+        return alive(e) && get_pool<T>().exists(entity_index(e));
     }
     template <typename T>
     pool<T>& entity_manager::get_pool() { return get_pool(type_tag<T>()); }
 
     entity entity_manager::add_entity() {
-        entity e = entities.least_unset_bit();
-        // add provision to handle resize
-        // also need to resize component pools
-        entities.set(e);
-        return e;
+        uint32_t index = next_index;
+        if (free_indices.empty()) {
+            assertion(next_index <= entity_index_mask, "Out of entity indices");
+            next_index++;
+            if (index >= entities.capacity())
+                resize(entities.capacity() * 2);
+        } else {
+            index = free_indices.back();
+            free_indices.pop_back();
+        }
+        entities.set(index);
+        return make_entity(index, generations[index]);
     }
     void entity_manager::remove_entity(entity e) {
-        entities.clear(e);
+        assertion(alive(e), "Cannot remove nonexistent entity");
+        uint32_t index = entity_index(e);
+        entities.clear(index);
+        // wraps before reaching the all-ones generation, which is left for command buffer placeholders
+        generations[index] = (generations[index] + 1) % entity_generation_mask;
+        free_indices.emplace_back(index);
         ALL_COMPONENTS(GENERATE_REMOVE_CALLS)
     }
+    bool entity_manager::alive(entity e) const {
+        uint32_t index = entity_index(e);
+        return index < next_index && entities.get(index) && generations[index] == entity_generation(e);
+    }
+
+    template <typename T, size_t N> static void save_spilled(snapshot_writer& w, const small_vector<T, N>& v) {
+        if (v.on_heap())
+            w.write(v.data(), v.size() * sizeof(T));
+    }
+    template <typename T, size_t N> static void load_spilled(snapshot_reader& r, small_vector<T, N>& v) {
+        if (v.on_heap())
+            r.read(v.detach_heap(), v.size() * sizeof(T));
+    }
+    void save_spilled(snapshot_writer& w, const display& d) { save_spilled(w, d.sprites); }
+    void load_spilled(snapshot_reader& r, display& d) { load_spilled(r, d.sprites); }
+    void save_spilled(snapshot_writer& w, const collision& c) {
+        save_spilled(w, c.hitboxes);
+        save_spilled(w, c.proxies);
+    }
+    void load_spilled(snapshot_reader& r, collision& c) {
+        load_spilled(r, c.hitboxes);
+        load_spilled(r, c.proxies);
+    }
+
+    #define GENERATE_SAVE_CALLS(T) POOL_NAME(T).save(w);
+    #define GENERATE_LOAD_CALLS(T) POOL_NAME(T).load(r, tick);
+    void entity_manager::save(snapshot_writer& w) const {
+        entities.save(w);
+        w.array(generations);
+        w.array(free_indices);
+        w.value(next_index);
+        ALL_COMPONENTS(GENERATE_SAVE_CALLS)
+    }
+    void entity_manager::load(snapshot_reader& r) {
+        entities.load(r);
+        r.array(generations);
+        r.array(free_indices);
+        r.value(next_index);
+        uint32_t tick = change_tick.load();
+        ALL_COMPONENTS(GENERATE_LOAD_CALLS)
+    }
+
 	void entity_manager::resize(size_t new_size) {
+        // component pools size themselves as components are added
         entities.resize(new_size);
-        ALL_COMPONENTS(GENERATE_RESIZE_CALLS)
+        generations.resize(new_size);
 	}
 
 
@@ -1,46 +1,319 @@
 #ifndef ECS_H
 #define ECS_H
 
+#include <common/aligned_allocator.h>
 #include <common/marked_array.h>
+#include <common/sparse_set.h>
 #include <common/coordinate_types.h>
+#include <common/small_vector.h>
 
-class engine;
+#include <atomic>
+#include <tuple>
+#include <bit>
+#include <algorithm>
+
+class thread_pool;
 namespace ecs {
-    using entity = uint8_t;
+    struct collision_world;
+
+    // Entities are handles, packing a slot index with that slot's generation. The generation is bumped whenever
+    // an entity is removed, so stale handles to a reused slot can be told apart from the slot's new owner.
+    using entity = uint32_t;
+    constexpr static unsigned entity_index_bits = 20;
+    constexpr static entity entity_index_mask = (entity(1) << entity_index_bits) - 1;
+    constexpr static entity entity_generation_mask = ~entity(0) >> entity_index_bits;
+    constexpr uint32_t entity_index(entity e) { return e & entity_index_mask; }
+    constexpr uint32_t entity_generation(entity e) { return e >> entity_index_bits; }
+    constexpr entity make_entity(uint32_t index, uint32_t generation) {
+        return (generation & entity_generation_mask) << entity_index_bits | index;
+    }
+
     template <typename T> struct type_tag {};
-    template <typename T> using pool = marked_vector<T>;
+    template <typename T> struct pool_type { using type = sparse_set<T>; };
+    template <typename T> using pool = typename pool_type<T>::type;
 
     struct component {
         entity entity_id;
     };
 
+    // Nearly every entity has one or two sprites and hitboxes, so they're kept inline in the pool
     struct display : public component {
-		std::vector<uint32_t> sprites;
+		small_vector<uint32_t, 2> sprites;
 	};
 
-    struct physics : public component {
-        vec2<float> velocity_cap;
-        vec2<float> accel;
-        vec2<float> velocity;
+    // A body's state lives in its pool's columns rather than in the component, so it can be integrated 8 at a time
+    struct physics : public component {};
+
+    // A body that moved during the last tick. Hitboxes follow the whole pixels it crossed, sprites follow it exactly.
+    struct body_move {
+        entity entity_id;
+        int32_t step_x, step_y;
+        float dx, dy;
     };
 
+    // Per-body state, one element per body in the pool's iteration order
+    struct body_columns {
+        // each column starts on a cache line, so integration can split them between threads without sharing lines
+        template <typename T> using column = std::vector<T, cache_aligned_allocator<T>>;
+
+        // position, in pixels; hitboxes follow its whole-pixel part. Starts at the entity's first sprite, and every
+        // move of the entity, or setting physics.position, carries it along
+        column<float> x, y;
+        column<float> vel_x, vel_y;
+        column<float> accel_x, accel_y;
+        column<float> cap_x, cap_y; // |velocity| limit on each axis
+        column<int32_t> step_x, step_y; // whole pixels crossed in the last tick
+        column<uint16_t> rest_ticks;    // consecutive ticks spent at rest
+
+        template <typename F> void for_each_column(F&& f) {
+            f(x); f(y); f(vel_x); f(vel_y); f(accel_x); f(accel_y); f(cap_x); f(cap_y); f(step_x); f(step_y); f(rest_ticks);
+        }
+        template <typename F> void for_each_column(F&& f) const {
+            f(x); f(y); f(vel_x); f(vel_y); f(accel_x); f(accel_y); f(cap_x); f(cap_y); f(step_x); f(step_y); f(rest_ticks);
+        }
+    };
+
+    // A sparse set of physics components that keeps `bodies` in step with it, so column i is always the i-th body.
+    // Awake bodies are kept in front of sleeping ones, so integration only has to walk the first num_awake() bodies.
+    class physics_pool {
+    public:
+        using element = physics;
+
+        bool exists(size_t id) const { return set.exists(id); }
+        // new bodies start awake
+        physics& insert(size_t id, const physics& p) {
+            if (set.exists(id))
+                return set.insert(id, p);
+            bodies.for_each_column([](auto& c) { c.emplace_back(); });
+            physics& added = set.insert(id, p);
+            wake(id);
+            return added;
+        }
+        void remove(size_t id) {
+            if (!set.exists(id))
+                return;
+            // move it to the border first, so filling its place from the back doesn't mix up the two halves
+            size_t i = set.index(id);
+            if (i < _num_awake)
+                swap_positions(i, --_num_awake);
+            i = set.index(id);
+            bodies.for_each_column([i](auto& c) {
+                c[i] = c.back();
+                c.pop_back();
+            });
+            set.remove(id);
+        }
+        physics& operator[] (size_t id) const { return set[id]; }
+        size_t index(size_t id) const { return set.index(id); }
+
+        bool awake(size_t id) const { return set.index(id) < _num_awake; }
+        size_t num_awake() const { return _num_awake; }
+        void wake(size_t id) {
+            size_t i = set.index(id);
+            bodies.rest_ticks[i] = 0;
+            if (i >= _num_awake)
+                swap_positions(i, _num_awake++);
+        }
+        // a sleeping body stops moving, but keeps whatever velocity it had (at most sleep_speed, when it's put to sleep
+        // for being at rest) for when it wakes
+        void sleep(size_t id) {
+            size_t i = set.index(id);
+            if (i >= _num_awake)
+                return;
+            bodies.step_x[i] = bodies.step_y[i] = 0;
+            swap_positions(i, --_num_awake);
+        }
+
+        void save(snapshot_writer& w) const {
+            set.save(w);
+            bodies.for_each_column([&](const auto& c) { w.array(c); });
+            w.value<uint64_t>(_num_awake);
+        }
+        void load(snapshot_reader& r, uint32_t tick) {
+            set.load(r, tick);
+            bodies.for_each_column([&](auto& c) { r.array(c); });
+            _num_awake = r.value<uint64_t>();
+        }
+
+        size_t size() const { return set.size(); }
+        const std::vector<uint32_t>& entities() const { return set.entities(); }
+        const hierarchical_bitset& markers() const { return set.markers(); }
+        const std::vector<uint32_t>& ticks() const { return set.ticks(); }
+        void set_tick(size_t id, uint32_t tick) { set.set_tick(id, tick); }
+        physics& at(size_t i) const { return set.at(i); }
+        auto begin() const { return set.begin(); }
+        auto end() const { return set.end(); }
+
+        body_columns bodies;
+        std::vector<body_move> moved; // written by run_physics, for the systems that carry hitboxes and sprites along
+        // update_sleep's working space, kept so it isn't allocated every tick
+        struct island_buffers {
+            std::vector<uint32_t> visited; // by entity index, the pass that last reached it
+            std::vector<uint32_t> disturbed; // by entity index, the pass in which it began a contact
+            uint32_t pass = 0;
+            std::vector<entity> stack, members, to_sleep, to_wake;
+        } islands;
+    private:
+        void swap_positions(size_t i, size_t j) {
+            if (i == j)
+                return;
+            bodies.for_each_column([i, j](auto& c) { std::swap(c[i], c[j]); });
+            set.swap_positions(i, j);
+        }
+
+        sparse_set<physics> set;
+        size_t _num_awake = 0;
+    };
+    template <> struct pool_type<physics> { using type = physics_pool; };
+
 	struct collision : public component {
 		using hitbox = std::array<vec2<uint16_t>, 4>;
-		std::vector<hitbox> hitboxes;
+		small_vector<hitbox, 1> hitboxes;
+		small_vector<uint32_t, 2> proxies; // aabb_tree leaves, parallel to `hitboxes`
 	};
 
-	void run_physics(engine* e, pool<display>& dpy, pool<physics>& phys);
-	void run_collision(pool<collision>& col);
+    // Snapshot support for components holding small_vectors, see sparse_set::save. Only the ones that spilled onto the
+    // heap have anything to save here; the rest are restored along with the pool's pages.
+    void save_spilled(snapshot_writer& w, const display& d);
+    void load_spilled(snapshot_reader& r, display& d);
+    void save_spilled(snapshot_writer& w, const collision& c);
+    void load_spilled(snapshot_reader& r, collision& c);
+
+	class entity_manager;
+	void run_physics(entity_manager& em, const collision_world& world, thread_pool& workers);
+	void run_collision(entity_manager& em, collision_world& world, thread_pool& workers);
 
     #define ALL_COMPONENTS(m) \
         m(display) m(physics) m(collision)
 
+    // Systems declare what they touch as masks, with a bit per component type and per piece of shared engine state
+    using access_mask = uint64_t;
+    #define GENERATE_COMPONENT_IDS(T) T ## _id,
+    enum component_id { ALL_COMPONENTS(GENERATE_COMPONENT_IDS) num_components };
+    template <typename T> constexpr access_mask component_bit = 0;
+    #define GENERATE_COMPONENT_BITS(T) template <> constexpr access_mask component_bit<T> = access_mask(1) << T ## _id;
+    ALL_COMPONENTS(GENERATE_COMPONENT_BITS)
+    template <typename... T> constexpr access_mask components = (component_bit<T> | ... | 0);
+    template <typename T> constexpr component_id component_index = component_id(std::countr_zero(component_bit<T>));
+
     // A series of higher-order macros to prevent duplicating function calls for each component type
     #define POOL_NAME(T) T ## _pool
     #define GENERATE_ACCESS_FUNCTIONS(T) constexpr pool<T>& get_pool(type_tag<T>) { return POOL_NAME(T); }
     #define GENERATE_POOLS(T) pool<T> POOL_NAME(T);
 
 
+    template <typename... T> struct exclude {};
+
+    // Iterates every living entity that has all of the included components, and none of the excluded ones.
+    // Matches are found by ANDing the pools' marker bits a word at a time, and words that any included pool
+    // has nothing in are skipped using the marker summaries, so a sparse pool costs about as much as its
+    // population. Dereferencing yields a tuple of references to the included components.
+    template <typename included, typename excluded> class query_view;
+
+    template <typename... I, typename... X>
+    class query_view<std::tuple<I...>, std::tuple<X...>> {
+    public:
+        query_view(const hierarchical_bitset& alive, std::tuple<pool<I>*...> include, std::tuple<pool<X>*...> exclude)
+            : alive(alive), include(include), exclude(exclude) {
+            num_words = alive.num_words();
+            std::apply([&](auto*... p) { ((num_words = std::min(num_words, p->markers().num_words())), ...); }, include);
+        }
+
+        class iterator {
+        public:
+            bool operator!=(const iterator& rhs) const { return w != rhs.w || bits != rhs.bits; }
+            std::tuple<I&...> operator*() const {
+                size_t index = w * hierarchical_bitset::bits_per_element + std::countr_zero(bits);
+                return std::tie((*std::get<pool<I>*>(v->include))[index]...);
+            }
+            iterator& operator++() {
+                bits &= bits - 1;
+                skip_empty();
+                return *this;
+            }
+        private:
+            iterator(const query_view* v, size_t w) : v(v), w(v->next_candidate(w)) {
+                if (this->w < v->num_words) {
+                    bits = v->word(this->w);
+                    skip_empty();
+                }
+            }
+            void skip_empty() {
+                while (bits == 0 && (w = v->next_candidate(w + 1)) < v->num_words)
+                    bits = v->word(w);
+            }
+
+            const query_view* v;
+            size_t w = 0;
+            size_t bits = 0;
+            friend class query_view;
+        };
+
+        iterator begin() const { return iterator(this, 0); }
+        iterator end() const { return iterator(this, num_words); }
+    private:
+        // The first word at or after `w` where the alive set and every included pool have some bit set, or
+        // num_words. Each set's next nonzero word is a lower bound on the answer, so leapfrog between them
+        // until they agree.
+        size_t next_candidate(size_t w) const {
+            for (;;) {
+                size_t next = alive.next_nonzero_word(w);
+                std::apply([&](auto*... p) { ((next = std::max(next, p->markers().next_nonzero_word(next))), ...); }, include);
+                if (next == w || next >= num_words)
+                    return std::min(next, num_words);
+                w = next;
+            }
+        }
+        size_t word(size_t w) const {
+            size_t bits = alive.word(w);
+            std::apply([&](auto*... p) { ((bits &= p->markers().word(w)), ...); }, include);
+            std::apply([&](auto*... p) { ((bits &= ~p->markers().word(w)), ...); }, exclude);
+            return bits;
+        }
+
+        const hierarchical_bitset& alive;
+        std::tuple<pool<I>*...> include;
+        std::tuple<pool<X>*...> exclude;
+        size_t num_words = 0;
+    };
+
+
+    // Iterates the components of one pool whose change tick is newer than `since`
+    template <typename T>
+    class changed_view {
+    public:
+        changed_view(pool<T>& p, uint32_t since) : p(p), since(since) {}
+
+        class iterator {
+        public:
+            T& operator*() { return v->p.at(i); }
+            bool operator!=(const iterator& rhs) const { return i != rhs.i; }
+            iterator& operator++() {
+                i++;
+                skip();
+                return *this;
+            }
+        private:
+            iterator(changed_view* v, size_t i) : v(v), i(i) { skip(); }
+            void skip() {
+                const std::vector<uint32_t>& ticks = v->p.ticks();
+                while (i < ticks.size() && ticks[i] <= v->since)
+                    i++;
+            }
+
+            changed_view* v;
+            size_t i;
+            friend class changed_view;
+        };
+
+        iterator begin() { return iterator(this, 0); }
+        iterator end() { return iterator(this, p.size()); }
+        bool empty() { return !(begin() != end()); }
+    private:
+        pool<T>& p;
+        uint32_t since;
+    };
+
     class entity_manager {
     public:
 	entity_manager() { resize(128); }
@@ -50,12 +323,39 @@ namespace ecs {
         template <typename T> bool exists(entity e);
         template <typename T> pool<T>& get_pool();
 
+        // Change tracking - add() and get() stamp the component with the current change tick, as both hand out
+        // mutable access. Writes through a view or straight into a pool have to call mark_changed themselves.
+        template <typename T> void mark_changed(entity e) {
+            get_pool<T>().set_tick(entity_index(e), change_tick.load(std::memory_order_relaxed));
+        }
+        // Ends the current change tick and returns it. A reader keeps the value from its previous checkpoint, and
+        // passes it to changed() to get everything stamped since, e.g.
+        //     uint32_t now = checkpoint(); for (auto& c : changed<collision>(last_seen)) {...} last_seen = now;
+        uint32_t checkpoint() { return change_tick.fetch_add(1); }
+        template <typename T> changed_view<T> changed(uint32_t since) { return changed_view<T>(get_pool<T>(), since); }
+
+        // e.g. `for (auto [p, d] : view<physics, display>(exclude<collision>()))`
+        template <typename... I, typename... X>
+        query_view<std::tuple<I...>, std::tuple<X...>> view(exclude<X...> = {}) {
+            return query_view<std::tuple<I...>, std::tuple<X...>>(entities,
+                std::make_tuple(&get_pool<I>()...), std::make_tuple(&get_pool<X>()...));
+        }
+
         entity add_entity();
         void remove_entity(entity e);
+        bool alive(entity e) const;
+
+        // Captures every entity and component. Loading marks every component as changed.
+        void save(snapshot_writer& w) const;
+        void load(snapshot_reader& r);
     private:
 		void resize(size_t new_size);
 
-        bitvector entities;
+        hierarchical_bitset entities;       // alive bit per slot index
+        std::vector<uint16_t> generations;  // current generation per slot index
+        std::vector<uint32_t> free_indices; // removed slots, ready for reuse
+        uint32_t next_index = 0;            // first slot index never handed out
+        std::atomic<uint32_t> change_tick = 1; // newer than the 0 pools start elements at
         ALL_COMPONENTS(GENERATE_ACCESS_FUNCTIONS)
         ALL_COMPONENTS(GENERATE_POOLS)
     };
@@ -1,12 +1,20 @@
 #include "engine.h"
 #include "ecs.h"
+#include "contacts.h"
+#include "aabb_tree.h"
+#include "scheduler.h"
+#include "commands.h"
+#include "snapshot.h"
 #include "modules.h"
 #include <interpreter.h>
 #include <common/coordinate_types.h>
+#include <common/stopwatch.h>
 
 #include <cstring>
 #include <cassert>
+#include <cmath>
 
+#include <algorithm>
 #include <map>
 #include <string>
 
@@ -31,6 +39,17 @@ public:
 */
 		set_res(r, 1024, 768);
 		set_cam(r, 0, 0);
+
+		// Physics only integrates bodies. Carrying hitboxes along has to finish before collision, but sprites can be
+		// moved while collision runs, since neither touches what the other does.
+		systems.add("physics", {ecs::resource_contacts, ecs::components<ecs::physics>},
+			[this] { ecs::run_physics(components, collisions, workers); });
+		systems.add("move hitboxes", {ecs::components<ecs::physics>, ecs::components<ecs::collision> | ecs::resource_spatial},
+			[this] { move_hitboxes(); });
+		systems.add("move sprites", {ecs::components<ecs::physics, ecs::display>, ecs::resource_renderer},
+			[this] { move_sprites(); });
+		systems.add("collision", {ecs::components<ecs::collision>, ecs::resource_contacts},
+			[this] { ecs::run_collision(components, collisions, workers); });
 	}
 
 	~engine() {
@@ -43,19 +62,43 @@ public:
 		swap_buffers(w);
 	}
 
+	// Structural changes systems recorded during the tick are applied once they've all finished
 	void run_tick() {
-		ecs::run_physics(this, components.get_pool<ecs::display>(), components.get_pool<ecs::physics>());
-		ecs::run_collision(components.get_pool<ecs::collision>());
-	};
+		systems.run(workers);
+		flush_commands();
+	}
+	void flush_commands() { commands.flush(components, [this](entity e, ecs::component_id c) { release(e, c); }); }
+	// Frees whatever the engine holds on behalf of one of an entity's components, before it's removed
+	void release(entity e, ecs::component_id c) {
+		if (c == ecs::display_id) {
+			for (auto s : components.get<ecs::display>(e).sprites)
+				deletesprite(r, s);
+		} else if (c == ecs::collision_id) {
+			for (auto p : components.get<ecs::collision>(e).proxies)
+				spatial.remove(p);
+		}
+	}
+
+	// Bodies that moved this tick carry their hitboxes and sprites along
+	void move_hitboxes();
+	void move_sprites();
 
 	// these should be shoved in private, once i properly interface them
 	renderer* r;
 	ecs::entity_manager components;
+	ecs::collision_world collisions;
+	ecs::aabb_tree spatial;
+	ecs::scheduler systems;
+	thread_pool workers;
+	ecs::command_queue commands{workers};
+	ecs::snapshot_ring snapshots;
+	size_t snapshot_bytes = 0, save_us = 0, load_us = 0; // from the most recent save and load
 	window* w;
 	audio* a;
 
 
 	std::map<std::string, std::vector<std::string>> functions;	
+	size_t running_scripts = 0; // nesting depth of `run`
 };
 
 
@@ -83,12 +126,20 @@ void run_tick(engine* e) { e->run_tick(); }
 void render(engine* e) { e->render(); }
 
 
-sprite addentity(engine* eng) {
-	uint32_t e = eng->components.add_entity();
+entity addentity(engine* eng) {
+	entity e = eng->components.add_entity();
 	eng->components.add<ecs::display>(e);
 	return e;
 }
 
+// While a script runs, the entity stays alive until the outermost script returns, so handles the script still holds,
+// such as the other side of a contact event, don't go stale halfway through
+void removeentity(engine* eng, entity e) {
+	eng->commands.local().destroy(e);
+	if (eng->running_scripts == 0)
+		eng->flush_commands();
+}
+
 sprite addsprite(engine* eng, entity e, uint16_t numquads) {
 	size_t sprid = addsprite(eng->r, numquads);
 	eng->components.get<ecs::display>(e).sprites.emplace_back(sprid);
@@ -107,57 +158,169 @@ void deserialize(vec2<float>& out, int argc, char** argv) {
 	out = vec2<float>{std::stof(argv[0]), std::stof(argv[1])};
 }
 
+// Hitboxes stop at the edges of their 16-bit space instead of wrapping around to the other side, and keep their shape
+void translate_hitboxes(engine* eng, entity e, int dx, int dy) {
+	if (!eng->components.exists<ecs::collision>(e) || (dx == 0 && dy == 0))
+		return;
+	auto& col = eng->components.get<ecs::collision>(e);
+	if (col.hitboxes.empty())
+		return;
+	aabb<int> bounds = ecs::hitbox_bounds(col.hitboxes[0]).to<int>();
+	for (const auto& hb : col.hitboxes) {
+		aabb<int> b = ecs::hitbox_bounds(hb).to<int>();
+		bounds = aabb<int>{{std::min(bounds.min.x, b.min.x), std::min(bounds.min.y, b.min.y)},
+		                   {std::max(bounds.max.x, b.max.x), std::max(bounds.max.y, b.max.y)}};
+	}
+	dx = std::clamp(dx, -bounds.min.x, UINT16_MAX - bounds.max.x);
+	dy = std::clamp(dy, -bounds.min.y, UINT16_MAX - bounds.max.y);
+	for (size_t h = 0; h < col.hitboxes.size(); h++) {
+		for (auto& vert : col.hitboxes[h])
+			vert = vec2<int>{vert.x + dx, vert.y + dy}.to<uint16_t>();
+		eng->spatial.move(col.proxies[h], ecs::hitbox_bounds(col.hitboxes[h]).to<int32_t>());
+	}
+}
+
+// The body is woken and carried along by `d`, so integration picks up from wherever the entity was put
+void move_body(engine* eng, entity e, vec2<float> d) {
+	if (!eng->components.exists<ecs::physics>(e))
+		return;
+	ecs::pool<ecs::physics>& bodies = eng->components.get_pool<ecs::physics>();
+	bodies.wake(ecs::entity_index(e));
+	size_t i = bodies.index(ecs::entity_index(e));
+	bodies.bodies.x[i] += d.x;
+	bodies.bodies.y[i] += d.y;
+}
+
+// Sprites and the body move by exactly `d`; hitboxes only by the whole pixels they cross, `step`
+void move_entity(engine* eng, entity e, const sprite* s, size_t n, vec2<float> d, vec2<int> step) {
+	move_body(eng, e, d);
+	translate_hitboxes(eng, e, step.x, step.y);
+	std::vector<float> offset_x(n, d.x), offset_y(n, d.y);
+	translate_sprites(eng->r, s, offset_x.data(), offset_y.data(), n);
+}
+
+// A new body starts at its entity's first sprite, or failing that its first hitbox
+void place_body(engine* eng, entity e) {
+	ecs::pool<ecs::physics>& bodies = eng->components.get_pool<ecs::physics>();
+	const ecs::pool<ecs::display>& displays = eng->components.get_pool<ecs::display>();
+	const ecs::pool<ecs::collision>& colliders = eng->components.get_pool<ecs::collision>();
+	uint32_t idx = ecs::entity_index(e);
+	size_t i = bodies.index(idx);
+	float x = 0, y = 0;
+	if (eng->components.exists<ecs::display>(e) && !displays[idx].sprites.empty()) {
+		get_origin(eng->r, displays[idx].sprites[0], &x, &y);
+	} else if (eng->components.exists<ecs::collision>(e) && !colliders[idx].hitboxes.empty()) {
+		aabb<uint16_t> box = ecs::hitbox_bounds(colliders[idx].hitboxes[0]);
+		x = box.min.x;
+		y = box.min.y;
+	}
+	bodies.bodies.x[i] = x;
+	bodies.bodies.y[i] = y;
+}
+
 void addcomponent(engine* eng, entity e, const char* name) {
 #define GENERATE_STRCMP_CALLS(T) \
 	else if (strcmp(#T, name) == 0) { \
 		eng->components.add<ecs::T>(e); \
 	}
 
+	bool had_body = eng->components.exists<ecs::physics>(e);
 	if (!eng) {}
 	ALL_COMPONENTS(GENERATE_STRCMP_CALLS)
+	if (!had_body && eng->components.exists<ecs::physics>(e))
+		place_body(eng, e);
 }
 
 void setattr(engine* eng, entity e, const char* attr, int argc, char** argv) {
+	ecs::pool<ecs::physics>& bodies = eng->components.get_pool<ecs::physics>();
+	auto set_body = [&](ecs::body_columns::column<float>& xs, ecs::body_columns::column<float>& ys) {
+		assertion(eng->components.exists<ecs::physics>(e), "Entity has no physics component");
+		vec2<float> v;
+		deserialize(v, argc, argv);
+		bodies.wake(ecs::entity_index(e));
+		size_t i = bodies.index(ecs::entity_index(e));
+		xs[i] = v.x;
+		ys[i] = v.y;
+	};
+	ecs::body_columns& b = bodies.bodies;
 	if (strcmp("physics.accel", attr) == 0) {
-		deserialize(eng->components.get<ecs::physics>(e).accel, argc, argv);
+		set_body(b.accel_x, b.accel_y);
 	} else if (strcmp("physics.velocity_cap", attr) == 0) {
-		deserialize(eng->components.get<ecs::physics>(e).velocity_cap, argc, argv);
+		set_body(b.cap_x, b.cap_y);
+	} else if (strcmp("physics.velocity", attr) == 0) {
+		set_body(b.vel_x, b.vel_y);
+	} else if (strcmp("physics.position", attr) == 0) {
+		// a teleport, so the sprites and hitboxes go along exactly as they would for moveto
+		assertion(eng->components.exists<ecs::physics>(e), "Entity has no physics component");
+		vec2<float> to;
+		deserialize(to, argc, argv);
+		size_t i = bodies.index(ecs::entity_index(e));
+		vec2<float> from{b.x[i], b.y[i]};
+		std::vector<sprite> sprites;
+		if (eng->components.exists<ecs::display>(e)) {
+			for (auto s : eng->components.get_pool<ecs::display>()[ecs::entity_index(e)].sprites)
+				sprites.emplace_back(s);
+		}
+		move_entity(eng, e, sprites.data(), sprites.size(), vec2<float>{to.x - from.x, to.y - from.y},
+			vec2<int>{int(std::floor(to.x) - std::floor(from.x)), int(std::floor(to.y) - std::floor(from.y))});
+		// set exactly, rather than leaving whatever rounding adding the offset gave
+		i = bodies.index(ecs::entity_index(e));
+		b.x[i] = to.x;
+		b.y[i] = to.y;
 	}
 }
 
-void delta_hb(std::array<vec2<uint16_t>, 4>& hb, int* mat) {
-	mat3<int> tfmat;
-	memcpy(tfmat.data, mat, 9 * sizeof(int));
-	for (auto& vert : hb) {
-		vec2<int> res = tfmat * vert.to<int>();
-		vert = res.to<uint16_t>();
-	}
+// sprite manipulation functions
+void moveto(engine* eng, entity e, sprite s, int x, int y) {
+	float ox = 0, oy = 0;
+	get_origin(eng->r, s, &ox, &oy);
+	move_entity(eng, e, &s, 1, vec2<float>{x - ox, y - oy}, vec2<int>{x - int(std::floor(ox)), y - int(std::floor(oy))});
 }
 
-
-void applydelta(engine* eng, entity e, sprite s, int* mat) {
-	if (eng->components.exists<ecs::collision>(e)) {
-		auto& col = eng->components.get<ecs::collision>(e);
-		for (auto& hb : col.hitboxes)
-			delta_hb(hb, mat);
+void moveby(engine* eng, entity e, sprite s, int dx, int dy) {
+	move_entity(eng, e, &s, 1, vec2<float>{float(dx), float(dy)}, vec2<int>{dx, dy});
+}
+void moveentities(engine* eng, const entity* es, const int* dx, const int* dy, size_t n) {
+	std::vector<sprite> sprites;
+	std::vector<float> offset_x, offset_y;
+	for (size_t i = 0; i < n; i++) {
+		if (eng->components.exists<ecs::display>(es[i])) {
+			for (auto s : eng->components.get<ecs::display>(es[i]).sprites) {
+				sprites.emplace_back(s);
+				offset_x.emplace_back(dx[i]);
+				offset_y.emplace_back(dy[i]);
+			}
+		}
+		move_body(eng, es[i], vec2<float>{float(dx[i]), float(dy[i])});
+		translate_hitboxes(eng, es[i], dx[i], dy[i]);
 	}
-
-	apply_tf(eng->r, s, mat);
+	translate_sprites(eng->r, sprites.data(), offset_x.data(), offset_y.data(), sprites.size());
 }
 
-// sprite manipulation functions
-void moveto(engine* eng, entity e, sprite s, int x, int y) {
-	uint16_t ox = 0, oy = 0;
-	get_origin(eng->r, s, &ox, &oy);
-	moveby(eng, e, s, x - ox, y - oy);
+void engine::move_hitboxes() {
+	for (const ecs::body_move& m : components.get_pool<ecs::physics>().moved) {
+		if (m.step_x != 0 || m.step_y != 0)
+			translate_hitboxes(this, m.entity_id, m.step_x, m.step_y);
+	}
 }
 
-void moveby(engine* eng, entity e, sprite s, int dx, int dy) {
-	mat3<int> tfmat = mat3<int>::identity();
-	tfmat.data[2] = dx;
-	tfmat.data[5] = dy;
-	applydelta(eng, e, s, tfmat.data);
+// Display components are only read, so they're looked up in the pool directly rather than stamped as changed
+void engine::move_sprites() {
+	ecs::pool<ecs::display>& displays = components.get_pool<ecs::display>();
+	std::vector<sprite> sprites;
+	std::vector<float> offset_x, offset_y;
+	for (const ecs::body_move& m : components.get_pool<ecs::physics>().moved) {
+		if (!components.exists<ecs::display>(m.entity_id))
+			continue;
+		for (auto s : displays[ecs::entity_index(m.entity_id)].sprites) {
+			sprites.emplace_back(s);
+			offset_x.emplace_back(m.dx);
+			offset_y.emplace_back(m.dy);
+		}
+	}
+	translate_sprites(r, sprites.data(), offset_x.data(), offset_y.data(), sprites.size());
 }
+void settransform(engine* e, sprite s, float rotation, float scale) { settransform(e->r, s, rotation, scale); }
 void setbounds(engine* e, sprite s, uint16_t quad, int x, int y, int w, int h) {
 	setbounds(e->r, s, quad, x, y, w, h);
 }
@@ -165,6 +328,11 @@ void setuv(engine* e, sprite s, uint16_t quad, float tlx, float tly, float w, fl
 	setuv(e->r, s, quad, tlx, tly, w, h);
 }
 void settex(engine* e, sprite s, texture t) { settex(e->r, s, t); }
+void setbatchcapacity(engine* e, size_t vertices) { setbatchcapacity(e->r, vertices); }
+void setinstancing(engine* e, bool enabled) { setinstancing(e->r, enabled); }
+void renderstats(engine* e, size_t* sprites, size_t* draw_calls, size_t* texture_binds, size_t* program_binds, size_t* upload_bytes) {
+	renderstats(e->r, sprites, draw_calls, texture_binds, program_binds, upload_bytes);
+}
 
 
 void addhitbox(engine* eng, entity e, int x, int y, int w, int h) {
@@ -178,6 +346,150 @@ void addhitbox(engine* eng, entity e, int x, int y, int w, int h) {
 	hb[2] = vec2<uint16_t>{x, y + h};
 	hb[3] = vec2<uint16_t>{x + w, y + h};
 	col.hitboxes.emplace_back(hb);
+	ecs::hitbox_ref ref{e, uint16_t(col.hitboxes.size() - 1)};
+	col.proxies.emplace_back(eng->spatial.insert(ecs::hitbox_bounds(hb).to<int32_t>(), ref));
+}
+
+size_t numsystems(engine* e) { return e->systems.timings().size(); }
+void systemtiming(engine* e, size_t idx, const char** name, size_t* start_us, size_t* elapsed_us, bool* critical) {
+	const ecs::system_timing& t = e->systems.timings()[idx];
+	*name = t.name.c_str();
+	*start_us = t.start_us;
+	*elapsed_us = t.elapsed_us;
+	*critical = t.critical;
+}
+size_t criticalpath(engine* e) { return e->systems.critical_path_us(); }
+
+// both force a full collision pass next tick, so the stats reflect the new settings
+void setcellsize(engine* e, uint16_t size) {
+	e->collisions.grid.set_cell_size(size);
+	e->collisions.rebuild = true;
+}
+
+bool setbroadphase(engine* e, const char* name) {
+	if (strcmp("bruteforce", name) == 0) {
+		e->collisions.mode = ecs::broadphase_mode::brute_force;
+	} else if (strcmp("grid", name) == 0) {
+		e->collisions.mode = ecs::broadphase_mode::grid;
+	} else if (strcmp("sap", name) == 0) {
+		e->collisions.mode = ecs::broadphase_mode::sweep_and_prune;
+	} else {
+		return false;
+	}
+	e->collisions.rebuild = true;
+	return true;
+}
+
+void physicsstats(engine* e, size_t* active, size_t* sleeping) {
+	const ecs::pool<ecs::physics>& bodies = e->components.get_pool<ecs::physics>();
+	*active = bodies.num_awake();
+	*sleeping = bodies.size() - bodies.num_awake();
+}
+
+// Everything a tick can change goes in: the ECS, the spatial tree, the contact cache and sprite vertices.
+// The broad phase's boxes are rebuilt from the loaded hitboxes on the next tick.
+uint64_t savestate(engine* e) {
+	stopwatch timer;
+	timer.start();
+	uint64_t frame;
+	std::vector<uint8_t>& buf = e->snapshots.next(frame);
+	snapshot_writer w(buf);
+	e->components.save(w);
+	e->spatial.save(w);
+	e->collisions.cache.save(w);
+	save_sprites(e->r, w);
+	e->snapshot_bytes = buf.size();
+	e->save_us = timer.elapsed<stopwatch::microseconds>();
+	return frame;
+}
+
+bool loadstate(engine* e, uint64_t frame) {
+	const std::vector<uint8_t>* buf = e->snapshots.find(frame);
+	if (!buf)
+		return false;
+	stopwatch timer;
+	timer.start();
+	snapshot_reader r(*buf);
+	e->components.load(r);
+	e->spatial.load(r);
+	e->collisions.cache.load(r);
+	load_sprites(e->r, r);
+	e->collisions.events.clear();
+	e->collisions.rebuild = true;
+	e->load_us = timer.elapsed<stopwatch::microseconds>();
+	return true;
+}
+
+void setsnapshotframes(engine* e, size_t n, size_t bytes_per_frame) {
+	e->snapshots.resize(n, bytes_per_frame ? bytes_per_frame : e->snapshots.frame_bytes());
+}
+
+void snapshotstats(engine* e, size_t* bytes, size_t* save_us, size_t* load_us) {
+	*bytes = e->snapshot_bytes;
+	*save_us = e->save_us;
+	*load_us = e->load_us;
+}
+
+size_t numcontactevents(engine* e) { return e->collisions.events.size(); }
+void contactevent(engine* e, size_t idx, int* kind, entity* a, entity* b) {
+	const ecs::contact_event& ev = e->collisions.events[idx];
+	*kind = int(ev.kind);
+	*a = ev.a;
+	*b = ev.b;
+}
+
+void collisionstats(engine* e, size_t* hitboxes, size_t* pairs, size_t* overlaps, size_t* swaps, size_t* elapsed_us) {
+	const ecs::collision_stats& stats = e->collisions.stats;
+	*hitboxes = stats.hitboxes;
+	*pairs = stats.candidate_pairs;
+	*overlaps = stats.overlaps;
+	*swaps = stats.sort_swaps;
+	*elapsed_us = stats.elapsed_us;
+}
+
+
+// Copies up to `max_out` entities to `out`, returning the total number available
+size_t copy_out(const std::vector<ecs::entity>& found, entity* out, size_t max_out) {
+	std::copy_n(found.begin(), std::min(found.size(), max_out), out);
+	return found.size();
+}
+
+size_t queryrect(engine* eng, int x, int y, int w, int h, entity* out, size_t max_out) {
+	std::vector<ecs::entity> found;
+	aabb<int32_t> box{vec2<int32_t>{x, y}, vec2<int32_t>{x + w, y + h}};
+	eng->spatial.query(box, [&](ecs::aabb_tree::proxy p) {
+		found.emplace_back(eng->spatial.data(p).entity_id);
+	});
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+	return copy_out(found, out, max_out);
+}
+
+size_t querypoint(engine* eng, int x, int y, entity* out, size_t max_out) {
+	return queryrect(eng, x, y, 0, 0, out, max_out);
+}
+
+size_t raycast(engine* eng, float x, float y, float dx, float dy, float len, entity* out, size_t max_out) {
+	float norm = std::sqrt(dx * dx + dy * dy);
+	if (norm == 0)
+		return 0;
+
+	std::vector<std::pair<ecs::entity, float>> hits;
+	vec2<float> dir{dx / norm, dy / norm};
+	eng->spatial.raycast(vec2<float>{x, y}, dir, len, [&](ecs::aabb_tree::proxy p, float t) {
+		hits.emplace_back(eng->spatial.data(p).entity_id, t);
+	});
+
+	// keep only the nearest hit for each entity, then order them by distance
+	auto same_entity = [](auto& lhs, auto& rhs) { return lhs.first == rhs.first; };
+	std::sort(hits.begin(), hits.end());
+	hits.erase(std::unique(hits.begin(), hits.end(), same_entity), hits.end());
+	std::sort(hits.begin(), hits.end(), [](auto& lhs, auto& rhs) { return lhs.second < rhs.second; });
+
+	std::vector<ecs::entity> found;
+	for (auto& [e, t] : hits)
+		found.emplace_back(e);
+	return copy_out(found, out, max_out);
 }
 
 
@@ -203,6 +515,14 @@ void loadscript(engine* eng, const char* name, int argc, const char** argv) {
 void run(engine* e, const char* name) {
 	interpreter i;
 	i.e = e;
+	struct script_scope {
+		engine* e;
+		script_scope(engine* e) : e(e) { e->running_scripts++; }
+		~script_scope() {
+			if (--e->running_scripts == 0)
+				e->flush_commands();
+		}
+	} scope(e);
 
 
 	auto& func = e->functions[name];
@@ -2,10 +2,11 @@
 #define ENGINE_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 class engine;
 
-using entity = uint16_t;
+using entity = uint32_t; // generational handle, stale handles never alias a newer entity
 using sprite = uint16_t;
 using texture = uint16_t;
 
@@ -16,7 +17,13 @@ bool poll_events(engine*);
 void run_tick(engine*);
 void render(engine*);
 
+// per-system timings from the most recent tick, with start times relative to the start of the tick
+size_t numsystems(engine*);
+void systemtiming(engine*, size_t idx, const char** name, size_t* start_us, size_t* elapsed_us, bool* critical);
+size_t criticalpath(engine*); // microseconds along the slowest chain of dependent systems
+
 entity addentity(engine*);
+void removeentity(engine*, entity); // deferred until the end of the script, when called from one
 sprite addsprite(engine*, entity, uint16_t numquads);
 void addcomponent(engine*, entity, const char* name);
 void setattr(engine*, entity, const char* attr, int argv, char** argc);
@@ -25,13 +32,50 @@ void setattr(engine*, entity, const char* attr, int argv, char** argc);
 // sprite manipulation functions
 void moveto(engine*, entity, sprite, int x, int y);
 void moveby(engine*, entity, sprite, int dx, int dy);
+// moves every sprite and hitbox of each entity by that entity's offset
+void moveentities(engine*, const entity*, const int* dx, const int* dy, size_t n);
+// rotation in radians, and scale, both about the sprite's origin - (0, 0) in the coordinates setbounds takes
+void settransform(engine*, sprite, float rotation, float scale);
 void setsize(engine*, sprite, uint16_t quad, int w, int h);
+// relative to the sprite's origin, which starts out at (0, 0) and goes wherever the sprite is moved
 void setbounds(engine*, sprite, uint16_t quad, int x, int y, int w, int h);
 void setuv(engine*, sprite, uint16_t quad, float tlx, float tly, float w, float y);
 void settex(engine*, sprite, texture);
+// the most vertices one draw call can hold (65536 by default), or a quarter as many quads when instancing
+void setbatchcapacity(engine*, size_t vertices);
+// whether quads are expanded into corners by the GPU (the default) or the CPU
+void setinstancing(engine*, bool);
+// counters from the last frame drawn; sprites are batched by texture, so draw calls grow with distinct textures
+void renderstats(engine*, size_t* sprites, size_t* draw_calls, size_t* texture_binds, size_t* program_binds, size_t* upload_bytes);
 
 
 void addhitbox(engine*, entity, int x1, int y1, int x2, int y2);
+void setcellsize(engine*, uint16_t size); // broadphase grid cell size, in pixels
+bool setbroadphase(engine*, const char* name); // one of "bruteforce", "grid" or "sap", false for anything else
+// counters from the most recent tick's collision pass
+void collisionstats(engine*, size_t* hitboxes, size_t* pairs, size_t* overlaps, size_t* swaps, size_t* elapsed_us);
+// Rollback - savestate captures the whole simulation into a ring of preallocated frames and returns its frame number.
+// loadstate restores one, and fails once `setsnapshotframes` newer saves have overwritten it (64 by default).
+// Each frame is preallocated for `bytes_per_frame`, 256KB by default, and 0 keeps the current size. snapshotstats
+// shows how much a save actually takes.
+uint64_t savestate(engine*);
+bool loadstate(engine*, uint64_t frame);
+void setsnapshotframes(engine*, size_t n, size_t bytes_per_frame);
+// size of the last snapshot, and how long the last save and load took
+void snapshotstats(engine*, size_t* bytes, size_t* save_us, size_t* load_us);
+
+// bodies still being integrated, and bodies asleep until something wakes them
+void physicsstats(engine*, size_t* active, size_t* sleeping);
+// contact events from the most recent tick, ordered by entity. `kind` is 0 when two hitboxes begin touching,
+// 1 while they stay touching, and 2 on the tick they stop
+size_t numcontactevents(engine*);
+void contactevent(engine*, size_t idx, int* kind, entity* a, entity* b);
+
+// spatial queries - each writes up to `max_out` distinct entities to `out`, and returns the total number found
+size_t querypoint(engine*, int x, int y, entity* out, size_t max_out);
+size_t queryrect(engine*, int x, int y, int w, int h, entity* out, size_t max_out);
+// entities are ordered nearest-first, along the ray from (x, y) towards (dx, dy), up to `len` pixels long
+size_t raycast(engine*, float x, float y, float dx, float dy, float len, entity* out, size_t max_out);
 
 
 void run(engine*, const char* scriptname);
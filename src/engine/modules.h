@@ -7,6 +7,8 @@
 class renderer;
 class audio;
 class window;
+class snapshot_writer;
+class snapshot_reader;
 
 // Rendering functions
 renderer* renderer_alloc();
@@ -20,11 +22,20 @@ sprite addsprite(renderer*, uint16_t numquads);
 void deletesprite(renderer*, sprite);
 void set_cam(renderer*, float cam_x, float cam_y);
 void set_res(renderer*, uint16_t res_x, uint16_t res_y);
-void apply_tf(renderer*, sprite, int* mat);
-void get_origin(renderer*, sprite, uint16_t* x, uint16_t* y);
+void settransform(renderer*, sprite, float rotation, float scale);
+void translate_sprites(renderer*, const sprite* sprites, const float* dx, const float* dy, size_t n);
+void get_origin(renderer*, sprite, float* x, float* y);
 void settex(renderer*, sprite, texture);
 void setbounds(renderer*, sprite, uint16_t quad, int x, int y, int w, int h);
 void setuv(renderer*, sprite, uint16_t quad, float tlx, float tly, float w, float h);
+// vertices per region of the streaming vertex buffer, which is also the largest a single draw can be
+void setbatchcapacity(renderer*, size_t vertices);
+void setinstancing(renderer*, bool);
+// counters from the last frame drawn
+void renderstats(renderer*, size_t* sprites, size_t* draw_calls, size_t* texture_binds, size_t* program_binds, size_t* upload_bytes);
+// every sprite's quads, texture and transform, for rollback
+void save_sprites(renderer*, snapshot_writer&);
+void load_sprites(renderer*, snapshot_reader&);
 
 
 // Window Management Functions
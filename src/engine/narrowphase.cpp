@@ -0,0 +1,189 @@
+#include "narrowphase.h"
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NARROWPHASE_X86
+#endif
+
+namespace ecs {
+
+    static void overlap_scalar(const hitbox_store& boxes, uint32_t a, const uint32_t* candidates, size_t n, uint8_t* hits) {
+        for (size_t i = 0; i < n; i++) {
+            uint32_t b = candidates[i];
+            hits[i] = boxes.min_x[a] < boxes.max_x[b] && boxes.min_x[b] < boxes.max_x[a]
+                && boxes.min_y[a] < boxes.max_y[b] && boxes.min_y[b] < boxes.max_y[a];
+        }
+    }
+
+#ifdef NARROWPHASE_X86
+    __attribute__((target("avx2")))
+    static void overlap_avx2(const hitbox_store& boxes, uint32_t a, const uint32_t* candidates, size_t n, uint8_t* hits) {
+        __m256i a_min_x = _mm256_set1_epi32(boxes.min_x[a]);
+        __m256i a_min_y = _mm256_set1_epi32(boxes.min_y[a]);
+        __m256i a_max_x = _mm256_set1_epi32(boxes.max_x[a]);
+        __m256i a_max_y = _mm256_set1_epi32(boxes.max_y[a]);
+
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i idx = _mm256_loadu_si256((const __m256i*) (candidates + i));
+            __m256i b_min_x = _mm256_i32gather_epi32(boxes.min_x.data(), idx, 4);
+            __m256i b_min_y = _mm256_i32gather_epi32(boxes.min_y.data(), idx, 4);
+            __m256i b_max_x = _mm256_i32gather_epi32(boxes.max_x.data(), idx, 4);
+            __m256i b_max_y = _mm256_i32gather_epi32(boxes.max_y.data(), idx, 4);
+
+            __m256i x = _mm256_and_si256(_mm256_cmpgt_epi32(b_max_x, a_min_x), _mm256_cmpgt_epi32(a_max_x, b_min_x));
+            __m256i y = _mm256_and_si256(_mm256_cmpgt_epi32(b_max_y, a_min_y), _mm256_cmpgt_epi32(a_max_y, b_min_y));
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(x, y)));
+            for (int k = 0; k < 8; k++)
+                hits[i + k] = (mask >> k) & 1;
+        }
+        // GCC turns the call below into a jump and leaves out the vzeroupper it normally puts on the way out, so the
+        // upper halves would stay dirty and slow down every SSE instruction the caller runs afterwards
+        _mm256_zeroupper();
+        overlap_scalar(boxes, a, candidates + i, n - i, hits + i);
+    }
+
+    // No gather instruction before AVX2, so candidates are loaded lane by lane and compared 4 at a time
+    __attribute__((target("sse4.1")))
+    static void overlap_sse4(const hitbox_store& boxes, uint32_t a, const uint32_t* candidates, size_t n, uint8_t* hits) {
+        __m128i a_min_x = _mm_set1_epi32(boxes.min_x[a]);
+        __m128i a_min_y = _mm_set1_epi32(boxes.min_y[a]);
+        __m128i a_max_x = _mm_set1_epi32(boxes.max_x[a]);
+        __m128i a_max_y = _mm_set1_epi32(boxes.max_y[a]);
+
+        auto load = [&](const std::vector<int32_t>& v, const uint32_t* c) {
+            return _mm_set_epi32(v[c[3]], v[c[2]], v[c[1]], v[c[0]]);
+        };
+
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            const uint32_t* c = candidates + i;
+            __m128i x = _mm_and_si128(_mm_cmpgt_epi32(load(boxes.max_x, c), a_min_x), _mm_cmpgt_epi32(a_max_x, load(boxes.min_x, c)));
+            __m128i y = _mm_and_si128(_mm_cmpgt_epi32(load(boxes.max_y, c), a_min_y), _mm_cmpgt_epi32(a_max_y, load(boxes.min_y, c)));
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(x, y)));
+            for (int k = 0; k < 4; k++)
+                hits[i + k] = (mask >> k) & 1;
+        }
+        overlap_scalar(boxes, a, candidates + i, n - i, hits + i);
+    }
+#endif //NARROWPHASE_X86
+
+    simd_level narrowphase_level() {
+        static simd_level level = [] {
+#ifdef NARROWPHASE_X86
+            if (__builtin_cpu_supports("avx2"))
+                return simd_level::avx2;
+            if (__builtin_cpu_supports("sse4.1"))
+                return simd_level::sse4;
+#endif
+            return simd_level::scalar;
+        }();
+        return level;
+    }
+
+    void overlap_candidates(const hitbox_store& boxes, uint32_t a, const uint32_t* candidates, size_t n, uint8_t* hits) {
+        switch (narrowphase_level()) {
+#ifdef NARROWPHASE_X86
+            case simd_level::avx2:
+                return overlap_avx2(boxes, a, candidates, n, hits);
+            case simd_level::sse4:
+                return overlap_sse4(boxes, a, candidates, n, hits);
+#endif
+            default:
+                return overlap_scalar(boxes, a, candidates, n, hits);
+        }
+    }
+
+
+    // Vertices are stored top-left, top-right, bottom-left, bottom-right, so walk them in that order to get the edges
+    constexpr static int perimeter_order[4] = {0, 1, 3, 2};
+
+    static void get_normals(vec2<int>* normals, const collision::hitbox& hb) {
+        for (size_t i = 0; i < 4; i++) {
+            vec2<uint16_t> start = hb[perimeter_order[i]];
+            vec2<uint16_t> end = hb[perimeter_order[(i + 1) % 4]];
+            vec2<int> edge = end.to<int>() - start.to<int>();
+            normals[i] = vec2<int>(-edge.y, edge.x);
+        }
+    }
+
+    // Project the vertices of the shape onto each normal, to determine overlaps and gaps
+    static void project_shape(vec2<int> normal, const collision::hitbox& hb, float& min, float& max) {
+        for (int i = 0; i < 4; i++) {
+            float projection = (float(hb[i].x) * normal.x) + (float(hb[i].y) * normal.y);
+            min = std::min(min, projection);
+            max = std::max(max, projection);
+        }
+    }
+
+    bool hitbox_overlap(const collision::hitbox& hb1, const collision::hitbox& hb2) {
+        vec2<int> normals[8];
+        get_normals(normals, hb1);
+        get_normals(normals + 4, hb2);
+
+        for (int i = 0; i < 8; i++) {
+            float a_min = std::numeric_limits<float>::max(), a_max = std::numeric_limits<float>::lowest();
+            float b_min = a_min, b_max = a_max;
+
+            project_shape(normals[i], hb1, a_min, a_max);
+            project_shape(normals[i], hb2, b_min, b_max);
+            if (a_max <= b_min || b_max <= a_min)
+                return false;
+        }
+        return true;
+    }
+
+
+    static void narrow_phase_range(const hitbox_store& boxes, const std::vector<candidate_pair>& pairs, size_t begin, size_t end,
+                                   std::vector<candidate_pair>& contacts) {
+        std::vector<uint32_t> candidates;
+        std::vector<uint8_t> hits;
+        for (size_t run_start = begin; run_start < end;) {
+            uint32_t a = pairs[run_start].a;
+            candidates.clear();
+            size_t run_end = run_start;
+            for (; run_end < end && pairs[run_end].a == a; run_end++)
+                candidates.emplace_back(pairs[run_end].b);
+
+            hits.resize(candidates.size());
+            overlap_candidates(boxes, a, candidates.data(), candidates.size(), hits.data());
+            for (size_t i = 0; i < candidates.size(); i++) {
+                uint32_t b = candidates[i];
+                if (!hits[i])
+                    continue;
+                // For axis-aligned boxes, overlapping bounds are already an exact answer
+                if (boxes.axis_aligned[a] && boxes.axis_aligned[b]) {
+                    contacts.emplace_back(candidate_pair{a, b});
+                } else if (hitbox_overlap(boxes.hitboxes[a], boxes.hitboxes[b])) {
+                    contacts.emplace_back(candidate_pair{a, b});
+                }
+            }
+            run_start = run_end;
+        }
+    }
+
+    // Pairs per chunk, which parallel_for groups into jobs; each run belongs to the chunk it starts in, so chunks
+    // never split a batch
+    constexpr static size_t pairs_per_chunk = 2048;
+
+    void narrow_phase(const hitbox_store& boxes, const std::vector<candidate_pair>& pairs, std::vector<candidate_pair>& contacts,
+                      thread_pool& workers) {
+        size_t num_chunks = (pairs.size() + pairs_per_chunk - 1) / pairs_per_chunk;
+        if (num_chunks <= 1)
+            return narrow_phase_range(boxes, pairs, 0, pairs.size(), contacts);
+
+        auto run_boundary = [&](size_t i) {
+            for (i = std::min(i, pairs.size()); i > 0 && i < pairs.size() && pairs[i].a == pairs[i - 1].a; i++);
+            return i;
+        };
+        std::vector<std::vector<candidate_pair>> found(num_chunks);
+        workers.parallel_for(0, num_chunks, 0, [&](size_t lo, size_t hi) {
+            for (size_t c = lo; c < hi; c++)
+                narrow_phase_range(boxes, pairs, run_boundary(c * pairs_per_chunk), run_boundary((c + 1) * pairs_per_chunk), found[c]);
+        });
+        for (auto& f : found)
+            contacts.insert(contacts.end(), f.begin(), f.end());
+    }
+}
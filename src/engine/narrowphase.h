@@ -0,0 +1,26 @@
+#ifndef NARROWPHASE_H
+#define NARROWPHASE_H
+
+#include "broadphase.h"
+#include <common/thread_pool.h>
+#include <vector>
+
+namespace ecs {
+    enum class simd_level { scalar, sse4, avx2 };
+    // The widest kernel the running CPU supports, detected once on first use
+    simd_level narrowphase_level();
+
+    // Writes 1 to `hits[i]` if the bounds of box `a` and `candidates[i]` overlap, and 0 otherwise.
+    // Boxes that merely touch along an edge don't overlap.
+    void overlap_candidates(const hitbox_store& boxes, uint32_t a, const uint32_t* candidates, size_t n, uint8_t* hits);
+
+    // Separating axis test, only needed when either hitbox isn't axis-aligned
+    bool hitbox_overlap(const collision::hitbox& hb1, const collision::hitbox& hb2);
+
+    // Appends each overlapping pair in `pairs` to `contacts`, in the same order. Runs of pairs sharing their first box
+    // are tested as a batch, so broad phases should report them adjacently. Large pair lists are split across `workers`.
+    void narrow_phase(const hitbox_store& boxes, const std::vector<candidate_pair>& pairs, std::vector<candidate_pair>& contacts,
+                      thread_pool& workers);
+}
+
+#endif //NARROWPHASE_H
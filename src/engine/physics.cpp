@@ -0,0 +1,146 @@
+#include "physics.h"
+#include "contacts.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PHYSICS_X86
+#endif
+
+namespace ecs {
+
+    static void integrate_scalar(body_columns& b, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            b.vel_x[i] = std::min(std::max(b.vel_x[i] + b.accel_x[i], -b.cap_x[i]), b.cap_x[i]);
+            b.vel_y[i] = std::min(std::max(b.vel_y[i] + b.accel_y[i], -b.cap_y[i]), b.cap_y[i]);
+
+            float x = b.x[i] + b.vel_x[i], y = b.y[i] + b.vel_y[i];
+            b.step_x[i] = int32_t(std::floor(x)) - int32_t(std::floor(b.x[i]));
+            b.step_y[i] = int32_t(std::floor(y)) - int32_t(std::floor(b.y[i]));
+            b.x[i] = x;
+            b.y[i] = y;
+        }
+    }
+
+#ifdef PHYSICS_X86
+    // Same operations as the scalar loop in the same order, so both give bit-identical results
+    __attribute__((target("avx2")))
+    static void integrate_axis_avx2(float* pos, float* vel, const float* accel, const float* cap, int32_t* step, size_t i) {
+        __m256 c = _mm256_loadu_ps(cap + i);
+        __m256 neg_c = _mm256_sub_ps(_mm256_setzero_ps(), c);
+        __m256 v = _mm256_add_ps(_mm256_loadu_ps(vel + i), _mm256_loadu_ps(accel + i));
+        v = _mm256_min_ps(_mm256_max_ps(v, neg_c), c);
+
+        __m256 old_pos = _mm256_loadu_ps(pos + i);
+        __m256 new_pos = _mm256_add_ps(old_pos, v);
+        __m256i moved = _mm256_sub_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(new_pos)), _mm256_cvttps_epi32(_mm256_floor_ps(old_pos)));
+
+        _mm256_storeu_ps(vel + i, v);
+        _mm256_storeu_ps(pos + i, new_pos);
+        _mm256_storeu_si256((__m256i*) (step + i), moved);
+    }
+
+    __attribute__((target("avx2")))
+    static void integrate_avx2(body_columns& b, size_t begin, size_t end) {
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            integrate_axis_avx2(b.x.data(), b.vel_x.data(), b.accel_x.data(), b.cap_x.data(), b.step_x.data(), i);
+            integrate_axis_avx2(b.y.data(), b.vel_y.data(), b.accel_y.data(), b.cap_y.data(), b.step_y.data(), i);
+        }
+        // as in the narrow phase, GCC makes the call below a jump without the vzeroupper it owes the caller
+        _mm256_zeroupper();
+        integrate_scalar(b, i, end);
+    }
+#endif //PHYSICS_X86
+
+    void integrate_bodies(body_columns& b, size_t begin, size_t end) {
+#ifdef PHYSICS_X86
+        static bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2)
+            return integrate_avx2(b, begin, end);
+#endif
+        integrate_scalar(b, begin, end);
+    }
+
+    void update_rest(body_columns& b, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            // any acceleration at all is motion someone asked for, which a speed threshold would miss until it built up
+            float speed_sq = b.vel_x[i] * b.vel_x[i] + b.vel_y[i] * b.vel_y[i];
+            bool resting = speed_sq <= sleep_speed_sq && b.accel_x[i] == 0 && b.accel_y[i] == 0;
+            b.rest_ticks[i] = resting ? std::min<uint16_t>(b.rest_ticks[i] + 1, sleep_ticks) : 0;
+        }
+    }
+
+    void update_sleep(entity_manager& em, const collision_world& world) {
+        pool<physics>& bodies = em.get_pool<physics>();
+        if (bodies.size() == 0)
+            return;
+        physics_pool::island_buffers& buf = bodies.islands;
+        if (++buf.pass == 0) {
+            std::fill(buf.visited.begin(), buf.visited.end(), 0);
+            std::fill(buf.disturbed.begin(), buf.disturbed.end(), 0);
+            buf.pass = 1;
+        }
+        auto stamp = [&](std::vector<uint32_t>& marks, entity e) {
+            uint32_t index = entity_index(e);
+            if (index >= marks.size())
+                marks.resize(index + 1, 0);
+            bool fresh = marks[index] != buf.pass;
+            marks[index] = buf.pass;
+            return fresh;
+        };
+        auto is_disturbed = [&](entity e) {
+            return entity_index(e) < buf.disturbed.size() && buf.disturbed[entity_index(e)] == buf.pass;
+        };
+
+        // Only islands with an awake body, or a new contact, can change state, so sleeping islands are never walked.
+        // Sleeping and waking shuffle positions in the pool, so every decision is made first and applied afterwards.
+        buf.to_sleep.clear();
+        buf.to_wake.clear();
+        auto walk_island = [&](entity seed) {
+            buf.members.clear();
+            buf.stack.clear();
+            buf.stack.emplace_back(seed);
+            bool rests = true;
+            while (!buf.stack.empty()) {
+                entity e = buf.stack.back();
+                buf.stack.pop_back();
+                buf.members.emplace_back(e);
+                size_t i = bodies.index(entity_index(e));
+                if (is_disturbed(e) || (i < bodies.num_awake() && bodies.bodies.rest_ticks[i] < sleep_ticks))
+                    rests = false;
+                for (const contact_graph::link& l : world.graph.links(e)) {
+                    if (em.exists<physics>(l.other) && stamp(buf.visited, l.other))
+                        buf.stack.emplace_back(l.other);
+                }
+            }
+            for (entity e : buf.members) {
+                bool awake = bodies.awake(entity_index(e));
+                if (rests && awake)
+                    buf.to_sleep.emplace_back(e);
+                else if (!rests && !awake)
+                    buf.to_wake.emplace_back(e);
+            }
+        };
+
+        for (entity e : world.graph.began()) {
+            if (em.exists<physics>(e))
+                stamp(buf.disturbed, e);
+        }
+        for (entity e : world.graph.began()) {
+            if (em.exists<physics>(e) && stamp(buf.visited, e))
+                walk_island(e);
+        }
+        for (size_t i = 0; i < bodies.num_awake(); i++) {
+            entity e = bodies.at(i).entity_id;
+            if (stamp(buf.visited, e))
+                walk_island(e);
+        }
+
+        for (entity e : buf.to_sleep)
+            bodies.sleep(entity_index(e));
+        for (entity e : buf.to_wake)
+            bodies.wake(entity_index(e));
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include "ecs.h"
+
+namespace ecs {
+    // Integrates bodies [begin, end): accelerates, clamps velocity to the caps, moves, and records how many whole
+    // pixels each body crossed in `step_x`/`step_y`. Uses AVX2 when the running CPU supports it.
+    void integrate_bodies(body_columns& b, size_t begin, size_t end);
+
+    // A body at rest is one with no acceleration, whose speed stayed at or below sleep_speed for sleep_ticks ticks
+    // in a row. The threshold soaks up float drift, so a body that's meant to be still does get to sleep.
+    constexpr static float sleep_speed = 0.01f; // pixels per tick
+    constexpr static float sleep_speed_sq = sleep_speed * sleep_speed;
+    constexpr static uint16_t sleep_ticks = 60;
+
+    // Counts rest ticks for bodies [begin, end), after they've been integrated
+    void update_rest(body_columns& b, size_t begin, size_t end);
+    // Bodies touching each other form islands, which fall asleep together once every body in them is at rest, and
+    // wake together as soon as any one of them isn't. A new contact with a sleeping body wakes its island too.
+    // Islands are walked over the contact graph from the last collision pass, starting only from awake bodies and
+    // new contacts.
+    void update_sleep(entity_manager& em, const collision_world& world);
+}
+
+#endif //PHYSICS_H
@@ -2,16 +2,38 @@
 #include <GL/glew.h>
 #include <cstring> //memcpy
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <memory>
 #include <common/coordinate_types.h>
 #include <common/marked_array.h>
+#include <common/skyline_packer.h>
+#include <common/snapshot_stream.h>
 
 
+constexpr static uint32_t no_texture = UINT32_MAX;
+
+// Where a sprite is drawn. Quads never move once they're set; the vertex shader rotates and scales them about the
+// sprite's origin, then moves that to `pos`.
+struct sprite_transform {
+    vec2<float> pos;    // in pixels
+    float rotation = 0; // in radians
+    float scale = 1;
+};
+
 struct spritedata {
-    std::vector<vertex> data;
-    uint32_t tex_id;
+    std::vector<quad> quads;
+    uint32_t tex_id = no_texture;
+    sprite_transform tf;
+    // whether `tf`'s position, or its rotation and scale, have changed since they were last uploaded
+    bool moved = true, reshaped = true;
 };
 
+// UVs are stored as 16-bit fractions of the atlas page
+static uint16_t to_unorm16(float f) { return uint16_t(std::lround(std::clamp(f, 0.0f, 1.0f) * 65535.0f)); }
+static float from_unorm16(uint16_t u) { return u / 65535.0f; }
+
 
 #include <libpng/png.h>
 #include <cassert>
@@ -59,62 +81,328 @@ private:
 };
 
 
+// Remembers what's bound, so asking for the program or texture that's already bound doesn't reach GL.
+// Counts the binds that do, for the per-frame stats.
+class gl_state_cache {
+public:
+    void use_program(uint32_t id) {
+        if (id == program)
+            return;
+        glUseProgram(id);
+        program = id;
+        program_binds++;
+    }
+    void bind_texture(uint32_t id) {
+        if (id == texture)
+            return;
+        glBindTexture(GL_TEXTURE_2D, id);
+        texture = id;
+        texture_binds++;
+    }
+    size_t program_binds = 0;
+    size_t texture_binds = 0;
+private:
+    uint32_t program = UINT32_MAX;
+    uint32_t texture = UINT32_MAX;
+};
+
+
+// One RG32F texel per sprite id, in a buffer texture the vertex shaders read from. Texels that change are staged and
+// go up before the frame is drawn, as runs of consecutive ids. Runs less than merge_gap apart are sent as one, since
+// a few unchanged texels cost less than another upload.
+class texel_column {
+public:
+    constexpr static size_t merge_gap = 64;
+
+    texel_column(uint32_t texture_unit) : texture_unit(texture_unit) {
+        glGenBuffers(1, &buffer);
+        glGenTextures(1, &texture);
+    }
+    void set(size_t id, vec2<float> v) {
+        if (id >= staged.size())
+            staged.resize(std::max(id + 1, staged.size() * 2));
+        staged[id] = v;
+        // ids are staged in increasing order, so only the last run can grow; anything else starts a new one
+        if (!dirty.empty() && id >= dirty.back().from && id <= dirty.back().to + merge_gap)
+            dirty.back().to = std::max(dirty.back().to, id + 1);
+        else
+            dirty.emplace_back(run{id, id + 1});
+    }
+    // returns the number of bytes uploaded
+    size_t upload() {
+        if (dirty.empty())
+            return 0;
+        size_t bytes = 0;
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        if (staged.size() != allocated) {
+            // grown, so everything goes up again, into a bigger buffer
+            bytes = staged.size() * sizeof(vec2<float>);
+            glBufferData(GL_TEXTURE_BUFFER, bytes, staged.data(), GL_DYNAMIC_DRAW);
+            glActiveTexture(GL_TEXTURE0 + texture_unit);
+            glBindTexture(GL_TEXTURE_BUFFER, texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, buffer);
+            glActiveTexture(GL_TEXTURE0);
+            allocated = staged.size();
+        } else {
+            for (const run& r : dirty) {
+                size_t run_bytes = (r.to - r.from) * sizeof(vec2<float>);
+                glBufferSubData(GL_TEXTURE_BUFFER, r.from * sizeof(vec2<float>), run_bytes, staged.data() + r.from);
+                bytes += run_bytes;
+            }
+        }
+        dirty.clear();
+        return bytes;
+    }
+private:
+    static_assert(sizeof(vec2<float>) == 8, "values are read as one RG32F texel each");
+    struct run {
+        size_t from, to;
+    };
+
+    std::vector<vec2<float>> staged;
+    std::vector<run> dirty;
+    size_t allocated = 0; // texels the buffer has room for
+    uint32_t texture_unit;
+    uint32_t buffer = 0, texture = 0;
+};
+
+// Every sprite's transform, indexed by sprite id. Positions change on nearly every move, while rotation and scale
+// rarely do, so they're kept apart and a moving sprite only sends its position. Rotation and scale go up as the
+// rotated and scaled x axis, so the shaders don't need any trig.
+struct transform_table {
+    constexpr static uint32_t positions_unit = 1, axes_unit = 2;
+
+    void set_position(size_t id, const sprite_transform& tf) { positions.set(id, tf.pos); }
+    void set_axis(size_t id, const sprite_transform& tf) {
+        axes.set(id, vec2<float>{std::cos(tf.rotation) * tf.scale, std::sin(tf.rotation) * tf.scale});
+    }
+    // returns the number of bytes uploaded
+    size_t upload() { return positions.upload() + axes.upload(); }
+
+    texel_column positions{positions_unit};
+    texel_column axes{axes_unit};
+};
+
+
+// Packs every texture into shared atlas pages, so sprites with different textures can still be drawn in one batch.
+// A texture handle names a region of a page. Sprite UVs are stored already mapped into their texture's region, and
+// remapped when a sprite changes texture. Images bigger than a page get a page of their own.
 // it's possible to use the "use" function to abstract away normal/height map binding
-// test if those aspects exist for the given texid, bind them to other texture units if so
+// test if those aspects exist for the given page, bind them to other texture units if so
 class texture_manager {
 public:
+    constexpr static uint16_t page_size = 2048;
+    // border left around each image and filled with copies of its edge texels, so sampling right at a region's edge
+    // can't pick up its neighbour or whatever the page held before
+    constexpr static uint16_t padding = 1;
+
     texture_manager() : textures(64) {};
-    uint32_t add(const uint8_t* buf, unsigned w, unsigned h) { return textures.insert_any(texgen(buf, w, h)); }
-    void use(size_t index) { glBindTexture(GL_TEXTURE_2D, textures[index]); }
+    uint32_t add(const uint8_t* buf, unsigned w, unsigned h, gl_state_cache& gl) {
+        region r;
+        r.size = vec2<uint16_t>{uint16_t(w), uint16_t(h)};
+        uint16_t padded_w = w + padding * 2, padded_h = h + padding * 2;
+        for (r.page = 0; r.page < pages.size(); r.page++) {
+            if (pages[r.page].packer.pack(padded_w, padded_h, r.pos))
+                break;
+        }
+        if (r.page == pages.size()) {
+            pages.emplace_back(new_page(std::max(page_size, padded_w), std::max(page_size, padded_h), gl));
+            pages.back().packer.pack(padded_w, padded_h, r.pos);
+        }
+
+        gl.bind_texture(pages[r.page].texid);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        extrude(buf, w, h);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, r.pos.x, r.pos.y, padded_w, padded_h, GL_RGB, GL_UNSIGNED_BYTE, padded.data());
+        r.pos = vec2<uint16_t>{uint16_t(r.pos.x + padding), uint16_t(r.pos.y + padding)};
+        return textures.insert_any(r);
+    }
+
+    // the page a texture lives on, or no_texture
+    uint32_t page(size_t tex) const { return textures.exists(tex) ? textures[tex].page : no_texture; }
+    // sprites without a (live) texture draw with none bound
+    void use_page(uint32_t page, gl_state_cache& gl) { gl.bind_texture(page < pages.size() ? pages[page].texid : 0); }
+
+    // Maps a UV within a texture to its place on the texture's page, and back. No texture means no mapping.
+    vec2<float> to_atlas(size_t tex, vec2<float> uv) const {
+        if (!textures.exists(tex))
+            return uv;
+        const region& r = textures[tex];
+        const skyline_packer& pg = pages[r.page].packer;
+        return vec2<float>{(r.pos.x + uv.x * r.size.x) / pg.width(), (r.pos.y + uv.y * r.size.y) / pg.height()};
+    }
+    vec2<float> from_atlas(size_t tex, vec2<float> uv) const {
+        if (!textures.exists(tex))
+            return uv;
+        const region& r = textures[tex];
+        const skyline_packer& pg = pages[r.page].packer;
+        return vec2<float>{(uv.x * pg.width() - r.pos.x) / r.size.x, (uv.y * pg.height() - r.pos.y) / r.size.y};
+    }
+    size_t num_pages() const { return pages.size(); }
 private:
-    marked_vector<uint32_t> textures;
+    struct region {
+        uint32_t page = 0;
+        vec2<uint16_t> pos;  // top-left texel on the page
+        vec2<uint16_t> size; // in texels
+    };
+    struct atlas_page {
+        uint32_t texid;
+        skyline_packer packer;
+    };
+
+    compact_marked_vector<region> textures;
+    std::vector<atlas_page> pages;
+    std::vector<uint8_t> padded; // the image being added, with its border, reused between adds
+
+    // Copies a w by h RGB image into `padded`, surrounded by `padding` texels repeating its nearest edge texel
+    void extrude(const uint8_t* buf, unsigned w, unsigned h) {
+        size_t padded_w = w + padding * 2, padded_h = h + padding * 2;
+        padded.resize(padded_w * padded_h * 3);
+        for (size_t y = 0; y < padded_h; y++) {
+            const uint8_t* src = buf + (std::clamp<size_t>(y, padding, h + padding - 1) - padding) * w * 3;
+            uint8_t* dst = &padded[y * padded_w * 3];
+            for (size_t p = 0; p < padding; p++) {
+                memcpy(dst + p * 3, src, 3);
+                memcpy(dst + (padding + w + p) * 3, src + (w - 1) * 3, 3);
+            }
+            memcpy(dst + padding * 3, src, w * 3);
+        }
+    }
 
-    uint32_t texgen(const uint8_t* buf, unsigned width, unsigned height) {
+    atlas_page new_page(uint16_t width, uint16_t height, gl_state_cache& gl) {
         // generate a texture object, and set some properties
         // we want to clamp sampling to not wrap-around, and use nearest-neighbor sampling
         uint32_t texid = 0;
         glGenTextures(1, &texid);
-        glBindTexture(GL_TEXTURE_2D, texid);
+        gl.bind_texture(texid);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        // this call is a fucking whirlwind, good luck!
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, buf);
-        return texid;
+        // this call is a fucking whirlwind, good luck! images are copied in later, so this only allocates
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        return atlas_page{texid, skyline_packer(width, height)};
     }
 };
 
 
 // Class to facilitate sprite batching
+// Records stream through one persistently mapped buffer, split into three regions used in turn. Batches are carved
+// out of the current region one after another. When it fills up, or the frame ends, a fence goes in behind its draws
+// and the next region is waited on, which only blocks if the GPU is still reading what was written there three
+// regions ago. The buffer is never remapped or orphaned, and one batch can hold a whole region.
+// That needs GL 4.4 or ARB_buffer_storage. Without either, records are staged in memory instead, and each batch goes
+// up into an orphaned buffer of one region right before it's drawn, always from the start of the buffer.
+template <typename T>
 struct batcher {
-    batcher() {
-        glGenBuffers(1, &vbo_id);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_id);
-        lock();
-    }
+    constexpr static size_t num_regions = 3;
+
+    batcher(size_t region_size) { allocate(region_size); }
+    ~batcher() { release_buffers(); }
 
     size_t size() { return batched; }
-    size_t capacity() { return 4096; }
-
-    // returns the number of vertices left unread
-    size_t add(vertex* in, size_t num_verts) {
-        size_t verts_to_copy = std::min(num_verts, capacity() - batched);
-        memcpy(buf + batched, in, verts_to_copy * sizeof(vertex));
-        batched += verts_to_copy;
-        return num_verts - verts_to_copy;
+    size_t capacity() { return region_size; }
+    // where the open batch starts in the buffer, as the base vertex or instance for its draw
+    size_t first() { return batch_start; }
+    uint32_t buffer() { return vbo_id; }
+
+    // whether the buffer is persistently mapped, rather than orphaned for every batch
+    bool persistent() { return !staging; }
+
+    // returns the number of records left unread, once the current region is full
+    size_t add(const T* in, size_t num) {
+        size_t region_end = (current + 1) * region_size;
+        size_t to_copy = std::min(num, region_end - (batch_start + batched));
+        memcpy(buf + batch_start + batched, in, to_copy * sizeof(T));
+        batched += to_copy;
+        return num - to_copy;
+    }
+    // Makes the open batch visible to the GPU, before it's drawn
+    void upload() {
+        if (persistent())
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_id);
+        glBufferData(GL_ARRAY_BUFFER, region_size * sizeof(T), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, batched * sizeof(T), buf);
     }
-    void lock()  {
-        glBufferData(GL_ARRAY_BUFFER, capacity() * sizeof(vertex), nullptr, GL_STREAM_DRAW);
-        buf = (vertex*) glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    // Closes the open batch once it's been drawn. The next one starts right after it, in the next region if this one's full
+    void next_batch() {
+        if (!persistent()) {
+            batched = 0;
+            return;
+        }
+        batch_start += batched;
         batched = 0;
+        if (batch_start == (current + 1) * region_size)
+            next_region();
+    }
+    // Moves on to a fresh region, so the next frame never writes over records this one's draws may still be reading
+    void end_frame() {
+        if (persistent() && batch_start != current * region_size)
+            next_region();
+    }
+    // Waits for the GPU to finish with the buffer, then replaces it with one of `size` records per region.
+    // Vertex array objects reading from the old buffer have to be pointed at the new one.
+    void resize(size_t size) {
+        release_buffers();
+        allocate(size);
     }
-    void release() { glUnmapBuffer(GL_ARRAY_BUFFER); }
 private:
-    vertex* buf = nullptr;
-    size_t batched = 0;
+    void allocate(size_t size) {
+        region_size = std::max<size_t>(size, 1);
+        glGenBuffers(1, &vbo_id);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_id);
+        if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+            size_t bytes = num_regions * region_size * sizeof(T);
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, bytes, nullptr, flags);
+            buf = (T*) glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+        } else {
+            glBufferData(GL_ARRAY_BUFFER, region_size * sizeof(T), nullptr, GL_STREAM_DRAW);
+            staging = std::make_unique<T[]>(region_size);
+            buf = staging.get();
+        }
+        current = 0;
+        batch_start = 0;
+        batched = 0;
+    }
+    void release_buffers() {
+        if (persistent()) {
+            for (GLsync& f : fences)
+                wait(f);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_id);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        staging.reset();
+        glDeleteBuffers(1, &vbo_id);
+    }
+
+    void next_region() {
+        fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current = (current + 1) % num_regions;
+        wait(fences[current]);
+        batch_start = current * region_size;
+        batched = 0;
+    }
+    static void wait(GLsync& fence) {
+        if (!fence)
+            return;
+        // the first wait also flushes, so the fence is guaranteed to signal eventually
+        GLbitfield flush = GL_SYNC_FLUSH_COMMANDS_BIT;
+        while (glClientWaitSync(fence, flush, 1000000) == GL_TIMEOUT_EXPIRED)
+            flush = 0;
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    T* buf = nullptr;                // the mapped buffer, or `staging`
+    std::unique_ptr<T[]> staging;    // one region's worth, without buffer storage
+    size_t region_size = 0;
+    size_t current = 0;     // region being written
+    size_t batch_start = 0; // first record of the open batch
+    size_t batched = 0;     // records in the open batch
+    std::array<GLsync, num_regions> fences{}; // set once a region's draws are queued, until it's reused
     uint32_t vbo_id = 0;
-    uint32_t vao_id = 0;
 };
 
 
@@ -154,18 +442,51 @@ private:
 
 class renderer {
 public:
+    constexpr static size_t default_batch_quads = 16384;
+
     renderer();
     void render();
 
     void draw_batch();
-
-    uint32_t program_id;
-    uint32_t ebo_id;
-	marked_vector<spritedata> sprites;
+    void set_batch_capacity(size_t quads);
+
+    // Instanced mode uploads each quad as one 20-byte record and expands it in the vertex shader. The other mode
+    // expands quads into four vertices on the CPU, for drivers where instancing is slow.
+    bool instanced = true;
+    // Without GL 4.2 or ARB_base_instance, instanced batches are drawn from the start of the attributes, so those are
+    // pointed at each batch in turn instead
+    bool base_instance = true;
+    size_t instance_attributes_first = 0; // the record the instance attributes start at, without base_instance
+    struct shader {
+        uint32_t program;
+        uint32_t cam; // uniform location of the camera matrix
+    } vertex_shader, instance_shader;
+	// paged, so adding sprites never copies existing vertex data, and lock-free so loaders can add them from any thread
+	concurrent_marked_vector<spritedata> sprites;
 
     camera_manager camera;
-    batcher batch;
+    batcher<vertex> vertex_batch{default_batch_quads * 4};
+    batcher<quad> instance_batch{default_batch_quads};
+    uint32_t vertex_vao = 0, instance_vao = 0;
+    uint32_t ebo_id = 0;
     texture_manager textures;
+    transform_table transforms;
+    gl_state_cache gl;
+
+    // counters from the last frame drawn
+    struct frame_stats {
+        size_t sprites = 0;
+        size_t draw_calls = 0;
+        size_t texture_binds = 0;
+        size_t program_binds = 0;
+        size_t upload_bytes = 0; // vertex, instance and transform data written for the GPU
+    } stats;
+private:
+    void setup_vertex_arrays();
+    void point_instance_attributes(size_t first);
+    template <typename T> void stream(batcher<T>& b, const T* in, size_t n);
+
+    std::vector<uint64_t> draw_order; // atlas page << 32 | sprite id, reused between frames
 };
 
 
@@ -208,20 +529,51 @@ uint32_t assemble_program(const char* vertcode, const char* fragcode) {
 }
 
 
+// Shared by both vertex shaders: takes a point relative to a sprite's origin into the world, with that sprite's
+// transform - rotated and scaled by its x axis, then moved to its position
+#define SPRITE_TRANSFORM_GLSL \
+"uniform samplerBuffer positions;\n" \
+"uniform samplerBuffer axes;\n" \
+"vec2 to_world(vec2 p, uint sprite) {\n" \
+    "vec2 r = texelFetch(axes, int(sprite)).xy;\n" \
+    "return texelFetch(positions, int(sprite)).xy + vec2(r.x * p.x - r.y * p.y, r.y * p.x + r.x * p.y);\n" \
+"}\n"
+
 const char* vertshader =
 "#version 330 core\n"
 
 "layout(location = 0) in vec2 vertexPosition_modelspace;\n"
 "layout(location = 1) in vec2 vertexUV;\n"
+"layout(location = 4) in uint vertexSprite;\n"
 "out vec2 UV;\n"
 
 "uniform mat4 cam;\n"
+SPRITE_TRANSFORM_GLSL
 
 "void main(){\n"
-    "gl_Position = cam * vec4(vertexPosition_modelspace, 0, 1);\n"
+    "gl_Position = cam * vec4(to_world(vertexPosition_modelspace, vertexSprite), 0, 1);\n"
     "UV = vertexUV;\n"
 "}\n";
 
+// Draws one quad per instance, as a 4-vertex triangle strip
+const char* instanced_vertshader =
+"#version 330 core\n"
+
+"layout(location = 2) in vec4 quadRect;\n" // x, y, width, height, in pixels
+"layout(location = 3) in vec4 quadUV;\n"   // top-left then bottom-right texture coordinates
+"layout(location = 4) in uint quadSprite;\n"
+"out vec2 UV;\n"
+
+"uniform mat4 cam;\n"
+SPRITE_TRANSFORM_GLSL
+
+"void main(){\n"
+    // corners go top-left, top-right, bottom-left, bottom-right, the same order sprite vertices always used
+    "vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+    "gl_Position = cam * vec4(to_world(quadRect.xy + corner * quadRect.zw, quadSprite), 0, 1);\n"
+    "UV = mix(quadUV.xy, quadUV.zw, corner);\n"
+"}\n";
+
 const char* fragshader =
 "#version 330 core\n"
 
@@ -246,60 +598,180 @@ void GLAPIENTRY MessageCallback(GLenum source, GLenum type, GLuint id, GLenum se
 
 
 renderer::renderer() {
-    glEnable(GL_DEBUG_OUTPUT);
-    glDebugMessageCallback(MessageCallback, 0);
+    // debug output is GL 4.3, and the rest of the renderer gets by on 3.3
+    if (GLEW_VERSION_4_3 || GLEW_KHR_debug) {
+        glEnable(GL_DEBUG_OUTPUT);
+        glDebugMessageCallback(MessageCallback, 0);
+    }
 
-    // feel it's best to load the shader first, maybe? no real reason
-    program_id = assemble_program(vertshader, fragshader);
-    glUseProgram(program_id);
+    base_instance = GLEW_VERSION_4_2 || GLEW_ARB_base_instance;
 
-    // element buffer :)
-    std::array<uint16_t, 4096 * 6> index_buffer{};
-    uint8_t lookup[] = {0, 1, 3, 3, 2, 0};
-    for (size_t i = 0; i < 4096; i++) {
-        index_buffer[i] = ((i / 6) * 4) + lookup[i % 6];
+    // feel it's best to load the shader first, maybe? no real reason
+    vertex_shader.program = assemble_program(vertshader, fragshader);
+    vertex_shader.cam = glGetUniformLocation(vertex_shader.program, "cam");
+    instance_shader.program = assemble_program(instanced_vertshader, fragshader);
+    instance_shader.cam = glGetUniformLocation(instance_shader.program, "cam");
+    for (uint32_t program : {vertex_shader.program, instance_shader.program}) {
+        gl.use_program(program);
+        glUniform1i(glGetUniformLocation(program, "positions"), transform_table::positions_unit);
+        glUniform1i(glGetUniformLocation(program, "axes"), transform_table::axes_unit);
     }
+
+    // element buffer :) every vertex-mode batch is drawn from its own base vertex, so one batch's worth of quads covers them all
     glGenBuffers(1, &ebo_id);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_id);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_buffer.size() * sizeof(uint16_t), &index_buffer[0], GL_STATIC_DRAW);
+    setup_vertex_arrays();
+}
+
+// Points each mode's vertex array object at its batcher's buffer, which has to be redone whenever they're resized
+void renderer::setup_vertex_arrays() {
+    if (!vertex_vao) {
+        glGenVertexArrays(1, &vertex_vao);
+        glGenVertexArrays(1, &instance_vao);
+    }
 
+    glBindVertexArray(vertex_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_batch.buffer());
     // note that XY and UV are two separate attribs, and that stride and offset accomodate interleaving
     // each attribute repeats every sizeof(vertex), while the second attribute has an offset from the first in memory
     glEnableVertexAttribArray(0);
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(0, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(vertex), 0);
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, sizeof(vertex), 0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(vertex), (void*) offsetof(vertex, uv));
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(vertex), (void*) offsetof(vertex, sprite));
 
-    camera.set_attr_idx(glGetUniformLocation(program_id, "cam"));
-    camera.use_sprite_cam();
+    std::vector<uint32_t> index_buffer(vertex_batch.capacity() / 4 * 6);
+    uint8_t lookup[] = {0, 1, 3, 3, 2, 0};
+    for (size_t i = 0; i < index_buffer.size(); i++) {
+        index_buffer[i] = ((i / 6) * 4) + lookup[i % 6];
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_id);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_buffer.size() * sizeof(uint32_t), index_buffer.data(), GL_STATIC_DRAW);
+
+    // position and size as one attribute, both UV corners as another, then the sprite, each advancing once per quad
+    glBindVertexArray(instance_vao);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    glEnableVertexAttribArray(4);
+    point_instance_attributes(0);
+    glVertexAttribDivisor(2, 1);
+    glVertexAttribDivisor(3, 1);
+    glVertexAttribDivisor(4, 1);
+}
+
+// Points the instance vertex array object's attributes at the quads from record `first` on
+void renderer::point_instance_attributes(size_t first) {
+    size_t base = first * sizeof(quad);
+    glBindBuffer(GL_ARRAY_BUFFER, instance_batch.buffer());
+    glVertexAttribPointer(2, 4, GL_SHORT, GL_FALSE, sizeof(quad), (void*) (base + offsetof(quad, pos)));
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(quad), (void*) (base + offsetof(quad, uv_from)));
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(quad), (void*) (base + offsetof(quad, sprite)));
+    instance_attributes_first = first;
+}
+
+void renderer::set_batch_capacity(size_t quads) {
+    quads = std::max<size_t>(quads, 1);
+    vertex_batch.resize(quads * 4);
+    instance_batch.resize(quads);
+    setup_vertex_arrays();
 }
 
 
 void renderer::draw_batch() {
-    batch.release();
-    //glDrawArrays(GL_TRIANGLES, 0, 6);
-    glDrawElements(GL_TRIANGLES, (batch.size() / 4) * 6, GL_UNSIGNED_SHORT, (void*) 0);
-    batch.lock();
+    if (instanced) {
+        if (instance_batch.size() == 0)
+            return;
+        instance_batch.upload();
+        if (base_instance) {
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, instance_batch.size(), instance_batch.first());
+        } else {
+            if (instance_batch.first() != instance_attributes_first)
+                point_instance_attributes(instance_batch.first());
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instance_batch.size());
+        }
+        stats.upload_bytes += instance_batch.size() * sizeof(quad);
+        instance_batch.next_batch();
+    } else {
+        if (vertex_batch.size() == 0)
+            return;
+        vertex_batch.upload();
+        glDrawElementsBaseVertex(GL_TRIANGLES, (vertex_batch.size() / 4) * 6, GL_UNSIGNED_INT, (void*) 0, vertex_batch.first());
+        stats.upload_bytes += vertex_batch.size() * sizeof(vertex);
+        vertex_batch.next_batch();
+    }
+    stats.draw_calls++;
 }
 
+// Copies records into the open batch, drawing it whenever the batcher's region fills up
+template <typename T>
+void renderer::stream(batcher<T>& b, const T* in, size_t n) {
+    while (n > 0) {
+        size_t remaining = b.add(in, n);
+        in += n - remaining;
+        n = remaining;
+        if (remaining > 0)
+            draw_batch();
+    }
+}
+
+// Sprites are drawn grouped by atlas page, and in id order within a group, so a batch is only flushed early when the
+// page changes or it fills up. Sprites on different pages don't draw in id order relative to each other.
 void renderer::render() {
+    stats = {};
+    gl.program_binds = gl.texture_binds = 0;
+    const shader& sh = instanced ? instance_shader : vertex_shader;
+    gl.use_program(sh.program);
+    glBindVertexArray(instanced ? instance_vao : vertex_vao);
+    camera.set_attr_idx(sh.cam);
     camera.use_sprite_cam();
-    for (auto& s : sprites) {
-        // if textures are different, draw batch now
 
-        size_t total_batched = 0;
-        while (total_batched < s.data.size()) {
-            size_t to_batch = s.data.size() - total_batched;
-            size_t remaining = batch.add(s.data.data() + total_batched, to_batch);
-            total_batched += to_batch - remaining;
+    draw_order.clear();
+    for (auto it = sprites.begin(); it != sprites.end(); ++it) {
+        spritedata& s = *it;
+        if (s.moved) {
+            transforms.set_position(it.index(), s.tf);
+            s.moved = false;
+        }
+        if (s.reshaped) {
+            transforms.set_axis(it.index(), s.tf);
+            s.reshaped = false;
+        }
+        draw_order.emplace_back(uint64_t(textures.page(s.tex_id)) << 32 | it.index());
+    }
+    std::sort(draw_order.begin(), draw_order.end());
+    stats.upload_bytes += transforms.upload();
+
+    uint64_t batch_page = UINT64_MAX;
+    for (uint64_t key : draw_order) {
+        spritedata& s = sprites[uint32_t(key)];
+        if (key >> 32 != batch_page) {
+            draw_batch();
+            batch_page = key >> 32;
+            textures.use_page(key >> 32, gl);
+        }
 
-            if (remaining > 0) {
-                draw_batch();
+        if (instanced) {
+            stream(instance_batch, s.quads.data(), s.quads.size());
+            continue;
+        }
+        for (const quad& q : s.quads) {
+            vertex corners[4];
+            for (int c = 0; c < 4; c++) {
+                int16_t cx = c & 1, cy = c >> 1;
+                corners[c].pos = vec2<int16_t>{int16_t(q.pos.x + cx * q.size.x), int16_t(q.pos.y + cy * q.size.y)};
+                corners[c].uv = vec2<float>{from_unorm16(cx ? q.uv_to.x : q.uv_from.x), from_unorm16(cy ? q.uv_to.y : q.uv_from.y)};
+                corners[c].sprite = q.sprite;
             }
-
+            stream(vertex_batch, corners, 4);
         }
     }
     draw_batch();
+    vertex_batch.end_frame();
+    instance_batch.end_frame();
+
+    stats.sprites = draw_order.size();
+    stats.texture_binds = gl.texture_binds;
+    stats.program_binds = gl.program_binds;
 }
 
 
@@ -315,19 +787,65 @@ void initglew() { glewInit(); }
 
 sprite addsprite(renderer* r, uint16_t numquads) {
 	spritedata s;
-	s.data.resize(numquads * 4);
-	return r->sprites.insert_any(s);
+	s.quads.resize(numquads);
+	sprite id = r->sprites.insert_any(s);
+	for (auto& q : r->sprites[id].quads)
+		q.sprite = id;
+	return id;
 }
 
 void deletesprite(renderer* r, sprite s) { r->sprites.remove(s); }
 
+void save_sprites(renderer* r, snapshot_writer& w) {
+	w.value<uint64_t>(r->sprites.capacity());
+	for (size_t i = 0; i < r->sprites.capacity(); i++) {
+		bool exists = r->sprites.exists(i);
+		w.value(exists);
+		if (exists) {
+			w.value(r->sprites[i].tex_id);
+			w.value(r->sprites[i].tf);
+			w.array(r->sprites[i].quads);
+		}
+	}
+}
+
+// Sprites that exist both now and in the snapshot keep their vertex buffers, so loading mostly just copies
+void load_sprites(renderer* r, snapshot_reader& rd) {
+	size_t capacity = rd.value<uint64_t>();
+	if (capacity > r->sprites.capacity())
+		r->sprites.set_capacity(capacity);
+	for (size_t i = 0; i < r->sprites.capacity(); i++) {
+		if (i >= capacity || !rd.value<bool>()) {
+			r->sprites.remove(i);
+			continue;
+		}
+		if (!r->sprites.exists(i))
+			r->sprites.insert(i, spritedata());
+		rd.value(r->sprites[i].tex_id);
+		rd.value(r->sprites[i].tf);
+		rd.array(r->sprites[i].quads);
+		r->sprites[i].moved = r->sprites[i].reshaped = true;
+	}
+}
+
 
 
 void draw(renderer* r) {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     r->render();
 }
-texture addtex(renderer* r, const uint8_t* buf, unsigned w, unsigned h) { return r->textures.add(buf, w, h); }
+texture addtex(renderer* r, const uint8_t* buf, unsigned w, unsigned h) { return r->textures.add(buf, w, h, r->gl); }
+
+void setbatchcapacity(renderer* r, size_t vertices) { r->set_batch_capacity(vertices / 4); }
+void setinstancing(renderer* r, bool enabled) { r->instanced = enabled; }
+
+void renderstats(renderer* r, size_t* sprites, size_t* draw_calls, size_t* texture_binds, size_t* program_binds, size_t* upload_bytes) {
+	*sprites = r->stats.sprites;
+	*draw_calls = r->stats.draw_calls;
+	*texture_binds = r->stats.texture_binds;
+	*program_binds = r->stats.program_binds;
+	*upload_bytes = r->stats.upload_bytes;
+}
 
 
 texture addtex(renderer* r, const char* filename) {
@@ -345,52 +863,65 @@ void set_res(renderer* r, uint16_t cam_x, uint16_t cam_y) { r->camera.set_res(ve
 
 // sprite manipulation functions
 vec2<uint16_t> getsize(renderer* eng, sprite s, uint16_t quad) {
-	spritedata& spr = eng->sprites[s];
-	uint16_t w = spr.data[quad * 4 + 3].pos.x - spr.data[quad * 4].pos.x;
-	uint16_t h = spr.data[quad * 4 + 3].pos.y - spr.data[quad * 4].pos.y;
-	return vec2<uint16_t>(w, h);
+	return eng->sprites[s].quads[quad].size.to<uint16_t>();
 }
 
-void moveby(renderer* eng, sprite s, int32_t dx, int32_t dy) {
-	spritedata& spr = eng->sprites[s];
-}
-
-
+// x and y are relative to the sprite's origin, so they only say where the quad is drawn while the sprite is untransformed
 void setbounds(renderer* r, sprite s, uint16_t quad, int x, int y, int w, int h) {
-	spritedata& spr = r->sprites[s];
-	spr.data[quad * 4].pos = vec2<uint16_t>{x, y};
-	spr.data[quad * 4 + 1].pos = vec2<uint16_t>{x + w, y};
-	spr.data[quad * 4 + 2].pos = vec2<uint16_t>{x, y + h};
-	spr.data[quad * 4 + 3].pos = vec2<uint16_t>{x + w, y + h};
+	auto& q = r->sprites[s].quads[quad];
+	q.pos = vec2<int16_t>{int16_t(x), int16_t(y)};
+	q.size = vec2<int16_t>{int16_t(w), int16_t(h)};
 }
 
 void setuv(renderer* r, sprite s, uint16_t quad, float x, float y, float w, float h) {
 	spritedata& spr = r->sprites[s];
-	spr.data[quad * 4].uv = vec2<float>{x, y};
-	spr.data[quad * 4 + 1].uv = vec2<float>{x + w, y};
-	spr.data[quad * 4 + 2].uv = vec2<float>{x, y + h};
-	spr.data[quad * 4 + 3].uv = vec2<float>{x + w, y + h};
+	// given relative to the sprite's own texture, and stored relative to its atlas page
+	auto to_atlas = [&](float u, float v) {
+		vec2<float> uv = r->textures.to_atlas(spr.tex_id, vec2<float>{u, v});
+		return vec2<uint16_t>{to_unorm16(uv.x), to_unorm16(uv.y)};
+	};
+	spr.quads[quad].uv_from = to_atlas(x, y);
+	spr.quads[quad].uv_to = to_atlas(x + w, y + h);
 }
 
+// UVs already set keep pointing at the same part of the image, now in the new texture's place on its page
 void settex(renderer* r, sprite s, texture texid) {
-	r->sprites[s].tex_id = texid;
+	spritedata& spr = r->sprites[s];
+	auto remap = [&](vec2<uint16_t>& uv) {
+		vec2<float> local = r->textures.from_atlas(spr.tex_id, vec2<float>{from_unorm16(uv.x), from_unorm16(uv.y)});
+		vec2<float> mapped = r->textures.to_atlas(texid, local);
+		uv = vec2<uint16_t>{to_unorm16(mapped.x), to_unorm16(mapped.y)};
+	};
+	for (auto& q : spr.quads) {
+		remap(q.uv_from);
+		remap(q.uv_to);
+	}
+	spr.tex_id = texid;
 }
 
 
 
-void apply_tf(renderer* r, sprite s, int* mat) {
+void settransform(renderer* r, sprite s, float rotation, float scale) {
 	spritedata& spr = r->sprites[s];
-	mat3<int> tfmat;
-	memcpy(tfmat.data, mat, 9 * sizeof(int));
-	for (auto& vert : spr.data) {
-		vec2<int> res = tfmat * vec2<int>{vert.pos.x, vert.pos.y};
-		vert.pos = vec2<uint16_t>{res.x, res.y};
+	spr.tf.rotation = rotation;
+	spr.tf.scale = scale;
+	spr.reshaped = true;
+}
+
+void translate_sprites(renderer* r, const sprite* sprites, const float* dx, const float* dy, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		spritedata& spr = r->sprites[sprites[i]];
+		spr.tf.pos.x += dx[i];
+		spr.tf.pos.y += dy[i];
+		spr.moved = true;
 	}
-};
+}
 
-void get_origin(renderer* r, sprite s, uint16_t* x, uint16_t* y) {
+// where the first quad's top-left corner is drawn
+void get_origin(renderer* r, sprite s, float* x, float* y) {
 	spritedata& spr = r->sprites[s];
-	*x = spr.data.front().pos.x;
-	*y = spr.data.front().pos.y;
+	vec2<float> p = spr.quads.front().pos.to<float>();
+	float c = std::cos(spr.tf.rotation) * spr.tf.scale, sn = std::sin(spr.tf.rotation) * spr.tf.scale;
+	*x = spr.tf.pos.x + c * p.x - sn * p.y;
+	*y = spr.tf.pos.y + sn * p.x + c * p.y;
 }
-
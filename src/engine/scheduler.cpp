@@ -0,0 +1,106 @@
+#include "scheduler.h"
+#include <common/stopwatch.h>
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace ecs {
+
+    void scheduler::add(std::string name, system_access access, std::function<void()> run) {
+        systems.emplace_back(system{std::move(name), access, std::move(run)});
+    }
+
+    void scheduler::build_graph() {
+        size_t n = systems.size();
+        successors.assign(n, {});
+        predecessors.assign(n, {});
+        for (size_t i = 0; i < n; i++) {
+            for (size_t j = i + 1; j < n; j++) {
+                const system_access& a = systems[i].access;
+                const system_access& b = systems[j].access;
+                if ((a.writes & (b.reads | b.writes)) || (b.writes & a.reads)) {
+                    successors[i].emplace_back(j);
+                    predecessors[j].emplace_back(i);
+                }
+            }
+        }
+    }
+
+    void scheduler::run(thread_pool& pool) {
+        build_graph();
+        size_t n = systems.size();
+        _timings.resize(n);
+        if (n == 0)
+            return;
+
+        std::vector<std::atomic<size_t>> remaining(n);
+        for (size_t i = 0; i < n; i++)
+            remaining[i] = predecessors[i].size();
+
+        std::mutex error_mutex;
+        std::atomic<size_t> finished = 0;
+        std::exception_ptr error;
+        stopwatch tick;
+        tick.start();
+
+        // Each system launches any successors it was the last dependency of
+        std::function<void(size_t)> launch = [&](size_t i) {
+            pool.submit([&, i] {
+                stopwatch timer;
+                _timings[i].name = systems[i].name;
+                _timings[i].start_us = tick.elapsed<stopwatch::microseconds>();
+                timer.start();
+                try {
+                    systems[i].run();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error)
+                        error = std::current_exception();
+                }
+                _timings[i].elapsed_us = timer.elapsed<stopwatch::microseconds>();
+
+                for (size_t s : successors[i]) {
+                    if (--remaining[s] == 0)
+                        launch(s);
+                }
+                finished.fetch_add(1);
+            });
+        };
+        for (size_t i = 0; i < n; i++) {
+            if (predecessors[i].empty())
+                launch(i);
+        }
+
+        // The calling thread runs systems too, rather than sleeping while the pool does
+        while (finished.load() < n) {
+            if (!pool.run_one())
+                std::this_thread::yield();
+        }
+        find_critical_path();
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    void scheduler::find_critical_path() {
+        size_t n = systems.size();
+        std::vector<size_t> finish(n, 0);
+        std::vector<size_t> slowest_pred(n, SIZE_MAX);
+        size_t last = 0;
+        for (size_t i = 0; i < n; i++) {
+            for (size_t p : predecessors[i]) {
+                if (slowest_pred[i] == SIZE_MAX || finish[p] > finish[slowest_pred[i]])
+                    slowest_pred[i] = p;
+            }
+            finish[i] = _timings[i].elapsed_us + (slowest_pred[i] == SIZE_MAX ? 0 : finish[slowest_pred[i]]);
+            _timings[i].critical = false;
+            if (finish[i] > finish[last])
+                last = i;
+        }
+
+        _critical_path_us = finish[last];
+        for (size_t i = last; i != SIZE_MAX; i = slowest_pred[i])
+            _timings[i].critical = true;
+    }
+}
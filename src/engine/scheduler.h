@@ -0,0 +1,56 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "ecs.h"
+#include <common/thread_pool.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ecs {
+    // Engine state outside of the component pools, which systems must also declare access to
+    constexpr access_mask resource_renderer = access_mask(1) << 32;
+    constexpr access_mask resource_spatial = access_mask(1) << 33;
+    constexpr access_mask resource_contacts = access_mask(1) << 34;
+
+    struct system_access {
+        access_mask reads = 0;
+        access_mask writes = 0;
+    };
+
+    struct system_timing {
+        std::string name;
+        size_t start_us = 0;   // relative to the start of the tick
+        size_t elapsed_us = 0;
+        bool critical = false; // on the longest chain of dependent systems this tick
+    };
+
+    // Runs registered systems once per tick. Two systems conflict if either writes something the other touches;
+    // conflicting systems run in registration order, and everything else is free to run at the same time.
+    class scheduler {
+    public:
+        void add(std::string name, system_access access, std::function<void()> run);
+        void run(thread_pool& pool);
+
+        const std::vector<system_timing>& timings() const { return _timings; }
+        // total time along the longest chain of dependent systems, in the last tick
+        size_t critical_path_us() const { return _critical_path_us; }
+    private:
+        struct system {
+            std::string name;
+            system_access access;
+            std::function<void()> run;
+        };
+        void build_graph();
+        void find_critical_path();
+
+        std::vector<system> systems;
+        std::vector<std::vector<size_t>> successors;
+        std::vector<std::vector<size_t>> predecessors;
+        std::vector<system_timing> _timings;
+        size_t _critical_path_us = 0;
+    };
+}
+
+#endif //SCHEDULER_H
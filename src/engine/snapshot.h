@@ -0,0 +1,54 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <common/snapshot_stream.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace ecs {
+    // A fixed number of snapshot buffers, reused oldest first. Each buffer is allocated and touched up front for
+    // `frame_bytes`, so saving many times a second never allocates or faults in fresh pages unless a snapshot outgrows
+    // that. Frames are numbered in the order they were saved, and each one can be found again until it's overwritten
+    // `size()` saves later.
+    class snapshot_ring {
+    public:
+        constexpr static size_t default_frame_bytes = 1 << 18;
+
+        snapshot_ring(size_t num_frames = 64, size_t frame_bytes = default_frame_bytes) { resize(num_frames, frame_bytes); }
+
+        // Empties the oldest buffer for reuse, and returns it along with its new frame number
+        std::vector<uint8_t>& next(uint64_t& frame) {
+            frame = next_frame++;
+            std::vector<uint8_t>& buf = frames[frame % frames.size()];
+            buf.clear();
+            return buf;
+        }
+        const std::vector<uint8_t>* find(uint64_t frame) const {
+            if (frame < first_frame || frame >= next_frame || next_frame - frame > frames.size())
+                return nullptr;
+            return &frames[frame % frames.size()];
+        }
+
+        size_t size() const { return frames.size(); }
+        size_t frame_bytes() const { return _frame_bytes; }
+        // Forgets every saved frame, but keeps numbering where it left off
+        void resize(size_t num_frames, size_t frame_bytes) {
+            frames.assign(std::max<size_t>(num_frames, 1), {});
+            for (std::vector<uint8_t>& buf : frames) {
+                buf.resize(frame_bytes);
+                buf.clear();
+            }
+            _frame_bytes = frame_bytes;
+            first_frame = next_frame;
+        }
+    private:
+        std::vector<std::vector<uint8_t>> frames;
+        uint64_t next_frame = 0;
+        uint64_t first_frame = 0; // frames before this were saved before the last resize
+        size_t _frame_bytes = 0;
+    };
+}
+
+#endif //SNAPSHOT_H
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string>
+#include <algorithm>
 
 #include "interpreter.h"
 
@@ -12,14 +13,74 @@ const char* interpreter::exec(const char* cmdin) {
 	argoffset = (varidx < 0) ? 1 : 2;
 	if (strcmp(cmd, "run_tick") == 0) {
 		run_tick(e);
+	} else if (strcmp(cmd, "savestate") == 0) {
+		sprintf(output, "%llu", (unsigned long long) savestate(e));
+	} else if (strcmp(cmd, "loadstate") == 0) {
+		sprintf(output, "%d", loadstate(e, argtoi(0)));
+	} else if (strcmp(cmd, "setsnapshotframes") == 0) {
+		// the frame size is optional
+		size_t bytes = argc - argoffset > 1 ? argtoi(1) : 0;
+		setsnapshotframes(e, argtoi(0), bytes);
+	} else if (strcmp(cmd, "snapshotstats") == 0) {
+		size_t bytes, save_us, load_us;
+		snapshotstats(e, &bytes, &save_us, &load_us);
+		sprintf(output, "%zu %zu %zu", bytes, save_us, load_us);
+	} else if (strcmp(cmd, "setbatchcapacity") == 0) {
+		setbatchcapacity(e, argtoi(0));
+	} else if (strcmp(cmd, "setinstancing") == 0) {
+		setinstancing(e, argtoi(0));
+	} else if (strcmp(cmd, "renderstats") == 0) {
+		size_t sprites, draw_calls, texture_binds, program_binds, upload_bytes;
+		renderstats(e, &sprites, &draw_calls, &texture_binds, &program_binds, &upload_bytes);
+		sprintf(output, "%zu %zu %zu %zu %zu", sprites, draw_calls, texture_binds, program_binds, upload_bytes);
+	} else if (strcmp(cmd, "physicsstats") == 0) {
+		size_t active, sleeping;
+		physicsstats(e, &active, &sleeping);
+		sprintf(output, "%zu %zu", active, sleeping);
+	} else if (strcmp(cmd, "contacts") == 0) {
+		// "kind:a:b" for each contact event, as many as fit
+		constexpr static const char* kinds[] = {"begin", "stay", "end"};
+		output[0] = '\0';
+		size_t len = 0;
+		for (size_t i = 0; i < numcontactevents(e); i++) {
+			int kind;
+			entity a, b;
+			contactevent(e, i, &kind, &a, &b);
+			char event[40];
+			int n = sprintf(event, i == 0 ? "%s:%u:%u" : " %s:%u:%u", kinds[kind], a, b);
+			if (len + n >= sizeof(output))
+				break;
+			memcpy(output + len, event, n + 1);
+			len += n;
+		}
+	} else if (strcmp(cmd, "systemstats") == 0) {
+		// "critical:total" then "name:start:elapsed" for each system, starred if it's on the critical path, as many as fit
+		size_t len = snprintf(output, sizeof(output), "critical:%zu", criticalpath(e));
+		for (size_t i = 0; i < numsystems(e); i++) {
+			const char* name;
+			size_t start_us, elapsed_us;
+			bool critical;
+			systemtiming(e, i, &name, &start_us, &elapsed_us, &critical);
+			int n = snprintf(output + len, sizeof(output) - len, " %s:%zu:%zu%s", name, start_us, elapsed_us,
+			                 critical ? "*" : "");
+			if (len + n >= sizeof(output)) {
+				output[len] = '\0';
+				break;
+			}
+			len += n;
+		}
 	} else if (strcmp(cmd, "render") == 0) {
 		render(e);
 	} else if (strcmp(cmd, "addentity") == 0) { 
-		sprintf(output, "%i", addentity(e));
+		sprintf(output, "%u", addentity(e));
+	} else if (strcmp(cmd, "removeentity") == 0) {
+		removeentity(e, argtoi(0));
 	} else if (strcmp(cmd, "addsprite") == 0) {
 		sprintf(output, "%i", addsprite(e, argtoi(0), argtoi(1)));
 	} else if (strcmp(cmd, "moveto") == 0) {
 		moveto(e, argtoi(0), argtoi(1), argtoi(2), argtoi(3));
+	} else if (strcmp(cmd, "settransform") == 0) {
+		settransform(e, argtoi(0), argtof(1), argtof(2));
 	} else if (strcmp(cmd, "setbounds") == 0) {
 		setbounds(e, argtoi(0), argtoi(1), argtoi(2), argtoi(3), argtoi(4), argtoi(5));
 	} else if (strcmp(cmd, "setuv") == 0) {
@@ -28,6 +89,29 @@ const char* interpreter::exec(const char* cmdin) {
 		settex(e, argtoi(0), argtoi(1));
 	} else if (strcmp(cmd, "addhitbox") == 0) {
 		addhitbox(e, argtoi(0), argtoi(1), argtoi(2), argtoi(3), argtoi(4));
+	} else if (strcmp(cmd, "setcellsize") == 0) {
+		setcellsize(e, argtoi(0));
+	} else if (strcmp(cmd, "setbroadphase") == 0) {
+		bool ok = setbroadphase(e, getarg(0));
+		if (!ok)
+			printf("Unrecognized broad phase: %s\n", getarg(0));
+		sprintf(output, "%d", ok);
+	} else if (strcmp(cmd, "collisionstats") == 0) {
+		size_t hitboxes, pairs, overlaps, swaps, elapsed_us;
+		collisionstats(e, &hitboxes, &pairs, &overlaps, &swaps, &elapsed_us);
+		sprintf(output, "%zu %zu %zu %zu %zu", hitboxes, pairs, overlaps, swaps, elapsed_us);
+	} else if (strcmp(cmd, "querypoint") == 0) {
+		std::array<entity, 32> found;
+		size_t n = querypoint(e, argtoi(0), argtoi(1), found.data(), found.size());
+		write_entities(found.data(), std::min(n, found.size()));
+	} else if (strcmp(cmd, "queryrect") == 0) {
+		std::array<entity, 32> found;
+		size_t n = queryrect(e, argtoi(0), argtoi(1), argtoi(2), argtoi(3), found.data(), found.size());
+		write_entities(found.data(), std::min(n, found.size()));
+	} else if (strcmp(cmd, "raycast") == 0) {
+		std::array<entity, 32> found;
+		size_t n = raycast(e, argtof(0), argtof(1), argtof(2), argtof(3), argtof(4), found.data(), found.size());
+		write_entities(found.data(), std::min(n, found.size()));
 	} else if (strcmp(cmd, "setattr") == 0) {
 		std::array<char*, 256> ptrarr;
 		int attr_args = argc - argoffset - 1; // first two are the entity and attr name
@@ -65,8 +149,22 @@ char* interpreter::decodearg(char* arg) {
 }
 
 char* interpreter::getarg(size_t i) { return decodearg(argv[i + argoffset]); }
-size_t interpreter::argtoi(size_t argi) { return std::stoi(decodearg(argv[argi + argoffset])); }
-size_t interpreter::argtof(size_t argi) { return std::stof(decodearg(argv[argi + argoffset])); }
+size_t interpreter::argtoi(size_t argi) { return std::stoll(decodearg(argv[argi + argoffset])); }
+float interpreter::argtof(size_t argi) { return std::stof(decodearg(argv[argi + argoffset])); }
+
+// Writes a space-separated list of entities to the output buffer, as many as fit
+void interpreter::write_entities(const entity* list, size_t n) {
+	output[0] = '\0';
+	size_t len = 0;
+	for (size_t i = 0; i < n; i++) {
+		int written = snprintf(output + len, sizeof(output) - len, i == 0 ? "%u" : " %u", list[i]);
+		if (len + written >= sizeof(output)) {
+			output[len] = '\0'; // drop the entity that was cut off
+			break;
+		}
+		len += written;
+	}
+}
 
 // as it stands, this function works, although it doesn't preserve the '='...
 // returns argc
@@ -19,7 +19,8 @@ private:
 
     char* getarg(size_t i);
     size_t argtoi(size_t argi);
-    size_t argtof(size_t argi);
+    float argtof(size_t argi);
+    void write_entities(const entity* list, size_t n);
 
     // as it stands, this function works, although it doesn't preserve the '='...
     // returns argc
@@ -0,0 +1,119 @@
+// concurrent_marked_vector under threads inserting and removing at once: no id is handed out twice, size() adds up,
+// and once the threads are done the lowest free slot is still the next one given out. Also grows well past 2^20.
+#include <common/marked_array.h>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { std::printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+constexpr size_t num_threads = 4;
+constexpr size_t rounds = 200;
+constexpr size_t batch = 300; // a little over a page, so threads keep crossing page boundaries
+constexpr size_t max_ids = num_threads * batch * 2;
+
+struct item {
+    size_t thread = 0;
+    size_t seq = 0;
+};
+
+static void stress() {
+    concurrent_marked_vector<item, 256> v;
+    std::vector<std::atomic<size_t>> owner(max_ids); // 1 + the thread holding each id, or 0
+    std::atomic<size_t> duplicates = 0, out_of_range = 0, corrupted = 0;
+    std::vector<std::vector<size_t>> kept(num_threads);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t] {
+            std::vector<size_t> held;
+            for (size_t r = 0; r < rounds; r++) {
+                for (size_t i = 0; i < batch; i++) {
+                    size_t id = v.insert_any(item{t, r * batch + i});
+                    if (id >= max_ids) {
+                        out_of_range++;
+                        continue;
+                    }
+                    if (owner[id].exchange(t + 1))
+                        duplicates++;
+                    held.push_back(id);
+                }
+                // keep every other one for a round, so pages fill up unevenly
+                std::vector<size_t> next;
+                for (size_t i = 0; i < held.size(); i++) {
+                    size_t id = held[i];
+                    if (!v.exists(id) || v[id].thread != t)
+                        corrupted++;
+                    if (i % 2 && r + 1 < rounds) {
+                        next.push_back(id);
+                        continue;
+                    }
+                    owner[id].store(0);
+                    v.remove(id);
+                }
+                held = std::move(next);
+            }
+            kept[t] = held;
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+
+    CHECK(duplicates == 0);
+    CHECK(out_of_range == 0);
+    CHECK(corrupted == 0);
+    CHECK(v.size() == 0);
+    for (const std::vector<size_t>& ids : kept)
+        CHECK(ids.empty());
+    size_t seen = 0;
+    for (item& i : v) {
+        (void) i;
+        seen++;
+    }
+    CHECK(seen == 0);
+
+    // every slot is free again, so the hint must not have been left past any of them
+    CHECK(v.insert_any(item{}) == 0);
+    CHECK(v.insert_any(item{}) == 1);
+    v.remove(0);
+    CHECK(v.insert_any(item{}) == 0);
+}
+
+// a slot freed on a page the hint has moved past is still found
+static void refill_after_remove() {
+    concurrent_marked_vector<item, 64> v;
+    for (size_t i = 0; i < 64 * 3; i++)
+        CHECK(v.insert_any(item{0, i}) == i);
+    v.remove(70);
+    v.remove(5);
+    CHECK(v.size() == 64 * 3 - 2);
+    CHECK(v.insert_any(item{}) == 5);
+    CHECK(v.insert_any(item{}) == 70);
+    CHECK(v.insert_any(item{}) == 64 * 3);
+}
+
+static void grows_past_old_limit() {
+    concurrent_marked_vector<int> v;
+    constexpr size_t n = (size_t(1) << 20) + 1000;
+    for (size_t i = 0; i < n; i++)
+        v.insert_any(int(i));
+    CHECK(v.size() == n);
+    CHECK(v.capacity() >= n);
+    CHECK(v[n - 1] == int(n - 1));
+
+    size_t far = size_t(3) << 20;
+    v.insert(far, 7);
+    CHECK(v.exists(far));
+    CHECK(v[far] == 7);
+    CHECK(!v.exists(far - 1));
+    CHECK(v.insert_any(0) == n);
+}
+
+int main() {
+    stress();
+    refill_after_remove();
+    grows_past_old_limit();
+    return failures == 0 ? 0 : 1;
+}
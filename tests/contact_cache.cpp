@@ -0,0 +1,54 @@
+// The contact cache only reuses a pair's narrow phase result while both hitboxes keep exactly the same vertices,
+// so a box that changes shape without changing its bounds is tested again
+#include <engine/contacts.h>
+#include <common/thread_pool.h>
+#include <cstdio>
+
+using namespace ecs;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { std::printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// vertices are top-left, top-right, bottom-left, bottom-right
+static collision::hitbox make_box(uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+    return {vec2<uint16_t>{x, y}, {uint16_t(x + w), y}, {x, uint16_t(y + h)}, {uint16_t(x + w), uint16_t(y + h)}};
+}
+// the square from (30, 30) to (70, 70), turned 45 degrees about its center, so it has the same bounds as before
+static collision::hitbox make_diamond() {
+    return {vec2<uint16_t>{50, 30}, {70, 50}, {30, 50}, {50, 70}};
+}
+
+int main() {
+    entity_manager em;
+    collision_world world;
+    thread_pool workers(2);
+
+    entity turning = em.add_entity();
+    em.add<collision>(turning).hitboxes.emplace_back(make_diamond());
+    // in the corner of the diamond's bounds, but outside the diamond itself
+    entity corner = em.add_entity();
+    em.add<collision>(corner).hitboxes.emplace_back(make_box(31, 31, 6, 6));
+
+    for (broadphase_mode mode : {broadphase_mode::brute_force, broadphase_mode::grid, broadphase_mode::sweep_and_prune}) {
+        world.mode = mode;
+        world.rebuild = true;
+        em.get<collision>(turning).hitboxes[0] = make_diamond();
+
+        run_collision(em, world, workers);
+        CHECK(world.pairs.size() == 1);
+        CHECK(world.contacts.empty());
+
+        // nothing changed, so the result is reused
+        run_collision(em, world, workers);
+        CHECK(world.contacts.empty());
+        CHECK(world.cache.hits() == 1);
+
+        // turned back square: same bounds, but now it reaches the corner
+        em.get<collision>(turning).hitboxes[0] = make_box(30, 30, 40, 40);
+        run_collision(em, world, workers);
+        CHECK(world.cache.hits() == 0);
+        CHECK(world.contacts.size() == 1);
+        CHECK(world.events.size() == 1 && world.events[0].kind == contact_event::type::begin);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,76 @@
+// Pool elements live in pages, so adding components never moves the ones already there, and a snapshot still walks
+// them in order a page at a time
+#include <common/paged_vector.h>
+#include <common/sparse_set.h>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { std::printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static void stable_growth() {
+    paged_vector<std::vector<int>, 4> v;
+    std::vector<int>& first = v.emplace_back(3, 7);
+    std::vector<int*> addresses;
+    for (int i = 0; i < 21; i++)
+        addresses.push_back(v.emplace_back(1, i).data());
+    CHECK(v.size() == 22);
+    CHECK(&v[0] == &first && first.size() == 3 && first[2] == 7);
+    for (int i = 0; i < 21; i++)
+        CHECK(v[i + 1].data() == addresses[i] && v[i + 1][0] == i);
+
+    // blocks cover every element in order, and only the last page is partly used
+    size_t seen = 0, blocks = 0;
+    v.for_each_block([&](const std::vector<int>* block, size_t n) {
+        CHECK(block == &v[seen]);
+        seen += n;
+        blocks++;
+    });
+    CHECK(seen == 22 && blocks == 6);
+
+    int i = -1;
+    for (const std::vector<int>& e : v) {
+        CHECK(i < 0 ? &e == &first : e[0] == i);
+        i++;
+    }
+    CHECK(i == 21);
+
+    // emptying keeps the pages, so refilling lands in the same places
+    v.resize(2);
+    CHECK(v.size() == 2 && v.back().size() == 1 && v.back()[0] == 0);
+    v.clear();
+    CHECK(v.empty());
+    CHECK(&v.emplace_back() == &first);
+}
+
+static void elements_destroyed() {
+    std::shared_ptr<int> counted = std::make_shared<int>(0);
+    {
+        paged_vector<std::shared_ptr<int>, 2> v;
+        for (int i = 0; i < 5; i++)
+            v.emplace_back(counted);
+        v.pop_back();
+        CHECK(counted.use_count() == 5);
+    }
+    CHECK(counted.use_count() == 1);
+}
+
+static void pool_references() {
+    sparse_set<int> s;
+    int& kept = s.insert(5, 42);
+    for (size_t id = 6; id < 5000; id++)
+        s.insert(id, int(id));
+    CHECK(&s[5] == &kept && kept == 42);
+    // removal still fills the gap from the back, which moves only that last element
+    s.remove(6);
+    CHECK(&s[5] == &kept);
+    CHECK(s[4999] == 4999 && s.at(s.index(4999)) == 4999);
+}
+
+int main() {
+    stable_growth();
+    elements_destroyed();
+    pool_references();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+// parallel_for covers the range exactly once, and chunks of a typed range start on whole cache lines of that type
+#include <common/thread_pool.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { std::printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+// the chunks parallel_for hands out, sorted
+template <typename T>
+static std::vector<std::pair<size_t, size_t>> chunks(thread_pool& workers, size_t begin, size_t end, size_t grain) {
+    std::vector<std::pair<size_t, size_t>> out;
+    std::mutex m;
+    workers.parallel_for<T>(begin, end, grain, [&](size_t lo, size_t hi) {
+        std::lock_guard<std::mutex> lock(m);
+        out.emplace_back(lo, hi);
+    });
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+template <typename T>
+static void covers(thread_pool& workers, size_t begin, size_t end, size_t grain) {
+    auto c = chunks<T>(workers, begin, end, grain);
+    CHECK(!c.empty());
+    CHECK(c.front().first == begin);
+    CHECK(c.back().second == end);
+    for (size_t i = 0; i < c.size(); i++) {
+        CHECK(c[i].first < c[i].second);
+        if (i > 0)
+            CHECK(c[i].first == c[i - 1].second);
+    }
+}
+
+int main() {
+    thread_pool workers(4);
+
+    covers<void>(workers, 0, 1000, 7);
+    covers<void>(workers, 3, 4, 0);
+    covers<float>(workers, 5, 1003, 100);
+    covers<uint16_t>(workers, 17, 100000, 0);
+
+    // untyped ranges keep the grain they're given
+    CHECK(chunks<void>(workers, 0, 100, 10).size() == 10);
+
+    // a float grain rounds up to 16, and every bound inside the range falls on a multiple of 16
+    auto c = chunks<float>(workers, 5, 1003, 20);
+    CHECK(c.size() == 32);
+    for (size_t i = 1; i < c.size(); i++)
+        CHECK(c[i].first % 16 == 0);
+
+    // with no grain given, each of the 4 workers gets 4 chunks
+    CHECK(chunks<void>(workers, 0, 1600, 0).size() == 16);
+    CHECK(chunks<void>(workers, 0, 3, 0).size() == 3);
+
+    // and cache aligned columns start on a line
+    std::vector<uint16_t, cache_aligned_allocator<uint16_t>> column(100);
+    CHECK(uintptr_t(column.data()) % cache_line_size == 0);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// Bodies only fall asleep once nothing is moving them, however slowly, and islands of touching bodies sleep together
+#include <engine/contacts.h>
+#include <engine/physics.h>
+#include <common/thread_pool.h>
+#include <cstdio>
+
+using namespace ecs;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { std::printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+struct world {
+    entity_manager em;
+    collision_world collisions;
+    thread_pool workers{2};
+
+    // a body at the origin, with the given velocity and acceleration on the x axis
+    entity add_body(float vel, float accel) {
+        entity e = em.add_entity();
+        em.add<physics>(e);
+        body_columns& b = em.get_pool<physics>().bodies;
+        size_t i = em.get_pool<physics>().index(entity_index(e));
+        b.vel_x[i] = vel;
+        b.accel_x[i] = accel;
+        b.cap_x[i] = b.cap_y[i] = 1000;
+        return e;
+    }
+    void add_hitbox(entity e, uint16_t x, uint16_t y) {
+        collision& c = em.exists<collision>(e) ? em.get<collision>(e) : em.add<collision>(e);
+        c.hitboxes.emplace_back(collision::hitbox{vec2<uint16_t>{x, y}, {uint16_t(x + 10), y}, {x, uint16_t(y + 10)},
+                                                  {uint16_t(x + 10), uint16_t(y + 10)}});
+    }
+    bool awake(entity e) { return em.get_pool<physics>().awake(entity_index(e)); }
+    void run(size_t ticks) {
+        for (size_t t = 0; t < ticks; t++) {
+            run_collision(em, collisions, workers);
+            run_physics(em, collisions, workers);
+        }
+    }
+};
+
+int main() {
+    {
+        world w;
+        entity still = w.add_body(0, 0);
+        w.run(sleep_ticks + 1);
+        CHECK(!w.awake(still));
+    }
+    {
+        // after sleep_ticks, the velocity this gives is still far below anything a speed threshold would notice
+        world w;
+        entity accelerating = w.add_body(0, 1e-6f);
+        w.run(sleep_ticks * 4);
+        CHECK(w.awake(accelerating));
+    }
+    {
+        // slow, but well above the threshold
+        world w;
+        entity slow = w.add_body(sleep_speed * 5, 0);
+        w.run(sleep_ticks * 4);
+        CHECK(w.awake(slow));
+    }
+    {
+        // under the threshold on each axis, but not once they're put together
+        world w;
+        entity diagonal = w.add_body(sleep_speed * 0.8f, 0);
+        auto& bodies = w.em.get_pool<physics>();
+        bodies.bodies.vel_y[bodies.index(entity_index(diagonal))] = sleep_speed * 0.8f;
+        w.run(sleep_ticks * 4);
+        CHECK(w.awake(diagonal));
+    }
+    {
+        // float drift well under the threshold sleeps, and keeps its velocity for when it's woken
+        world w;
+        entity drifting = w.add_body(sleep_speed * 0.1f, 0);
+        w.run(sleep_ticks + 1);
+        CHECK(!w.awake(drifting));
+        CHECK(w.em.get_pool<physics>().bodies.vel_x[0] == sleep_speed * 0.1f);
+    }
+    {
+        // putting a body to sleep doesn't throw away the velocity it was given
+        world w;
+        entity e = w.add_body(2, 0);
+        auto& bodies = w.em.get_pool<physics>();
+        bodies.sleep(entity_index(e));
+        CHECK(!w.awake(e));
+        CHECK(bodies.bodies.vel_x[bodies.index(entity_index(e))] == 2);
+    }
+    {
+        // a stack of touching bodies sleeps and wakes as one, without disturbing a sleeping body elsewhere
+        world w;
+        entity a = w.add_body(0, 0), b = w.add_body(0, 0), far = w.add_body(0, 0);
+        w.add_hitbox(a, 0, 0);
+        w.add_hitbox(b, 5, 5);
+        w.add_hitbox(far, 500, 500);
+        w.run(sleep_ticks + 1);
+        CHECK(!w.awake(a) && !w.awake(b) && !w.awake(far));
+
+        auto& bodies = w.em.get_pool<physics>();
+        bodies.wake(entity_index(a));
+        bodies.bodies.vel_x[bodies.index(entity_index(a))] = 1;
+        w.run(1);
+        CHECK(w.awake(a) && w.awake(b) && !w.awake(far));
+    }
+    {
+        // a new contact wakes whatever it touches
+        world w;
+        entity sleeper = w.add_body(0, 0), other = w.add_body(0, 0);
+        w.add_hitbox(sleeper, 0, 0);
+        w.add_hitbox(other, 100, 100);
+        w.run(sleep_ticks + 1);
+        CHECK(!w.awake(sleeper) && !w.awake(other));
+
+        collision& c = w.em.get<collision>(other);
+        c.hitboxes[0] = collision::hitbox{vec2<uint16_t>{5, 5}, {15, 5}, {5, 15}, {15, 15}};
+        w.run(1);
+        CHECK(w.awake(sleeper) && w.awake(other));
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// Pools are restored from a snapshot a page at a time, with small_vectors that spilled onto the heap patched up
+// afterwards, so loading has to give back exactly what was saved, however often it's repeated, without two
+// components ending up sharing (or leaking) a heap block
+#include <engine/contacts.h>
+#include <common/flat_hash_map.h>
+#include <common/thread_pool.h>
+#include <cstdio>
+#include <vector>
+
+using namespace ecs;
+
+static int failures = 0;
+#define CHECK(cond) do { if (!(cond)) { std::printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static collision::hitbox make_box(uint16_t x, uint16_t y) {
+    return {vec2<uint16_t>{x, y}, {uint16_t(x + 10), y}, {x, uint16_t(y + 10)}, {uint16_t(x + 10), uint16_t(y + 10)}};
+}
+
+static void pools() {
+    entity_manager em;
+    std::vector<entity> es;
+    for (uint32_t i = 0; i < 50; i++) {
+        entity e = em.add_entity();
+        es.emplace_back(e);
+        // every third one spills onto the heap
+        display& d = em.add<display>(e);
+        for (uint32_t s = 0; s < (i % 3 == 0 ? 5 : 1); s++)
+            d.sprites.emplace_back(i * 10 + s);
+        collision& c = em.add<collision>(e);
+        for (uint16_t h = 0; h < (i % 3 == 0 ? 3 : 1); h++) {
+            c.hitboxes.emplace_back(make_box(uint16_t(i * 20), h));
+            c.proxies.emplace_back(i * 10 + h);
+        }
+    }
+    std::vector<uint8_t> buf;
+    snapshot_writer w(buf);
+    em.save(w);
+
+    // change everything, spilled or not, then restore more than once
+    for (entity e : es) {
+        em.get<display>(e).sprites.emplace_back(999u);
+        em.get<collision>(e).hitboxes[0] = make_box(1, 1);
+    }
+    em.remove_entity(es[3]);
+    for (int round = 0; round < 3; round++) {
+        snapshot_reader r(buf);
+        em.load(r);
+        for (uint32_t i = 0; i < es.size(); i++) {
+            const display& d = em.get<display>(es[i]);
+            const collision& c = em.get<collision>(es[i]);
+            size_t n = i % 3 == 0 ? 5 : 1;
+            CHECK(d.sprites.size() == n);
+            CHECK(d.sprites.on_heap() == (n > 2));
+            for (uint32_t s = 0; s < d.sprites.size(); s++)
+                CHECK(d.sprites[s] == i * 10 + s);
+            CHECK(c.hitboxes.size() == (i % 3 == 0 ? 3u : 1u));
+            CHECK(c.proxies.size() == c.hitboxes.size());
+            for (uint16_t h = 0; h < c.hitboxes.size(); h++) {
+                CHECK(c.hitboxes[h] == make_box(uint16_t(i * 20), h));
+                CHECK(c.proxies[h] == i * 10 + h);
+            }
+        }
+        // restored spilled vectors own their blocks, so growing one leaves the others alone
+        em.get<display>(es[0]).sprites.emplace_back(7u);
+        CHECK(em.get<display>(es[3]).sprites[0] == 30u);
+    }
+}
+
+struct int_hash {
+    size_t operator()(int k) const { return size_t(k) * 0x9e3779b97f4a7c15ull; }
+};
+
+static void flat_map() {
+    flat_hash_map<int, int, int_hash> m;
+    for (int i = 0; i < 1000; i++)
+        CHECK(m.try_emplace(i, i * 2).second);
+    CHECK(!m.try_emplace(5, 0).second);
+    CHECK(*m.find(5) == 10);
+    m.erase_if([](int k, int) { return k % 2 == 1; });
+    CHECK(m.size() == 500);
+    CHECK(!m.find(7));
+    // refilling over the tombstones
+    for (int i = 1; i < 1000; i += 2)
+        m.try_emplace(i, -i);
+    CHECK(m.size() == 1000);
+    CHECK(*m.find(7) == -7);
+
+    std::vector<uint8_t> buf;
+    snapshot_writer w(buf);
+    m.save(w);
+    m.clear();
+    CHECK(!m.find(7));
+    snapshot_reader r(buf);
+    m.load(r);
+    CHECK(m.size() == 1000);
+    size_t sum = 0;
+    m.for_each([&](int k, int) { sum += k; });
+    CHECK(sum == 999 * 1000 / 2);
+}
+
+int main() {
+    pools();
+    flat_map();
+    return failures == 0 ? 0 : 1;
+}